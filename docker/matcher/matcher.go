@@ -24,14 +24,17 @@ const KeyBytes = 32
 const AuthBytes = 16
 const MacBytes = 16
 const ConnectTokenBytes = 1024
+const ConnectTokenAdditionalDataBytes = 20
 const MaxServersPerConnectToken = 8
 const ConnectTokenExpirySeconds = 30
 const ServerAddress = "127.0.0.1:40000"
+const ServerId = 0
 
 type ConnectToken struct {
     ProtocolId         string `json:"protocolId"`
     ClientId           string `json:"clientId"`
     ExpiryTimestamp    string `json:"expiryTimestamp"`
+    ServerId           string `json:"serverId"`
     NumServerAddresses string `json:"numServerAddresses"`
     ServerAddresses [] string `json:"serverAddresses"`
     ClientToServerKey  string `json:"clientToServerKey"`
@@ -51,7 +54,7 @@ func PrintBytes( label string, data [] byte ) {
     fmt.Printf( "\n" )
 }
 
-func Encrypt( message [] byte, nonce uint64, key [] byte ) ( []byte, bool ) {
+func Encrypt( message [] byte, additional [] byte, nonce uint64, key [] byte ) ( []byte, bool ) {
     nonceBytes := make( []byte, 8 )
     binary.LittleEndian.PutUint64( nonceBytes, nonce )
     encrypted := make( []byte, len(message) + AuthBytes )
@@ -61,8 +64,8 @@ func Encrypt( message [] byte, nonce uint64, key [] byte ) ( []byte, bool ) {
         &encryptedLengthLongLong,
         (*C.uchar) ( &message[0] ),
         (C.ulonglong) ( len( message ) ),
-        (*C.uchar) ( nil ),
-        (C.ulonglong) ( 0 ),
+        (*C.uchar) ( &additional[0] ),
+        (C.ulonglong) ( len( additional ) ),
         (*C.uchar) ( nil ),
         (*C.uchar) ( &nonceBytes[0] ),
         (*C.uchar) ( &key[0] ) ) ) == 0
@@ -71,11 +74,12 @@ func Encrypt( message [] byte, nonce uint64, key [] byte ) ( []byte, bool ) {
     return encrypted, ok
 }
 
-func GenerateConnectToken( protocolId uint32, clientId uint64, serverAddresses [] string ) ConnectToken {
+func GenerateConnectToken( protocolId uint32, clientId uint64, serverId uint64, serverAddresses [] string ) ConnectToken {
     connectToken := ConnectToken {}
     connectToken.ProtocolId = strconv.FormatUint( uint64(protocolId), 10 )
     connectToken.ClientId = strconv.FormatUint( clientId, 10 )
     connectToken.ExpiryTimestamp = strconv.FormatUint( uint64( time.Now().Unix() + ConnectTokenExpirySeconds ), 10 )
+    connectToken.ServerId = strconv.FormatUint( serverId, 10 )
     connectToken.NumServerAddresses = strconv.Itoa( len( serverAddresses ) )
     connectToken.ServerAddresses = serverAddresses
     connectToken.ClientToServerKey = base64.StdEncoding.EncodeToString( GenerateKey() )
@@ -84,17 +88,30 @@ func GenerateConnectToken( protocolId uint32, clientId uint64, serverAddresses [
     return connectToken
 }
 
+func GenerateConnectTokenAdditionalData( connectToken ConnectToken ) [] byte {
+    protocolId, _ := strconv.ParseUint( connectToken.ProtocolId, 10, 32 )
+    expiryTimestamp, _ := strconv.ParseUint( connectToken.ExpiryTimestamp, 10, 64 )
+    serverId, _ := strconv.ParseUint( connectToken.ServerId, 10, 64 )
+    additional := make( []byte, ConnectTokenAdditionalDataBytes )
+    binary.LittleEndian.PutUint32( additional[0:4], uint32( protocolId ) )
+    binary.LittleEndian.PutUint64( additional[4:12], expiryTimestamp )
+    binary.LittleEndian.PutUint64( additional[12:20], serverId )
+    return additional
+}
+
 func EncryptConnectToken( connectToken ConnectToken, nonce uint64 ) ( []byte, bool ) {
     connectTokenJSON, error := json.Marshal( connectToken )
     tokenData := make( []byte, ConnectTokenBytes - AuthBytes )
     for i := 0; i < len( connectTokenJSON ); i++ { tokenData[i] = connectTokenJSON[i] }
     if ( error != nil ) { return []byte(nil), false }
-    return Encrypt( tokenData, nonce, PrivateKey )
+    return Encrypt( tokenData, GenerateConnectTokenAdditionalData( connectToken ), nonce, PrivateKey )
 }
 
 type MatchResponse struct {
     ConnectTokenData   string `json:"connectTokenData"`
     ConnectTokenNonce  string `json:"connectTokenNonce"`
+    ConnectTokenExpireTimestamp string `json:"connectTokenExpireTimestamp"`
+    ConnectTokenServerId string `json:"connectTokenServerId"`
     ServerAddresses [] string `json:"serverAddresses"`
     ClientToServerKey  string `json:"clientToServerKey"`
     ServerToClientKey  string `json:"serverToClientKey"`
@@ -103,6 +120,8 @@ type MatchResponse struct {
 func GenerateMatchResponse( connectToken ConnectToken, nonce uint64 ) ( MatchResponse, bool ) {
     matchResponse := MatchResponse {}
     matchResponse.ConnectTokenNonce = strconv.FormatUint( nonce, 10 )
+    matchResponse.ConnectTokenExpireTimestamp = connectToken.ExpiryTimestamp
+    matchResponse.ConnectTokenServerId = connectToken.ServerId
     encryptedConnectToken, ok := EncryptConnectToken( connectToken, nonce )
     if ( ok ) { matchResponse.ConnectTokenData = base64.StdEncoding.EncodeToString( encryptedConnectToken ) }
     matchResponse.ServerAddresses = connectToken.ServerAddresses
@@ -129,7 +148,7 @@ func MatchHandler( w http.ResponseWriter, r * http.Request ) {
     clientId, _ := strconv.ParseUint( vars["clientId"], 10, 64 )
     protocolId, _ := strconv.ParseUint( vars["protocolId"], 10, 32 )
     serverAddresses := []string { Base64EncodeString( ServerAddress ) }
-    connectToken := GenerateConnectToken( uint32( protocolId ), clientId, serverAddresses[:] )
+    connectToken := GenerateConnectToken( uint32( protocolId ), clientId, ServerId, serverAddresses[:] )
     matchResponse, ok := GenerateMatchResponse( connectToken, atomic.AddUint64( &MatchNonce, 1 ) )
     w.Header().Set( "Content-Type", "application/json" )
     if ( ok ) { 
@@ -5,7 +5,7 @@ if os.is "windows" then
     debug_libs = { "sodium-debug", "mbedtls-debug", "mbedx509-debug", "mbedcrypto-debug" }
     release_libs = { "sodium-release", "mbedtls-release", "mbedx509-release", "mbedcrypto-release" }
 else
-    debug_libs = { "sodium", "mbedtls", "mbedx509", "mbedcrypto" }
+    debug_libs = { "sodium", "mbedtls", "mbedx509", "mbedcrypto", "pthread" }
     release_libs = debug_libs
 end
 
@@ -82,6 +82,10 @@ project "simple_messages"
     files { "tests/simple_messages.cpp", "tests/shared.h" }
     links { "yojimbo" }
 
+project "flood"
+    files { "tests/flood.cpp", "tests/shared.h" }
+    links { "yojimbo" }
+
 if not os.is "windows" then
 
     -- MacOSX and Linux.
@@ -253,6 +257,18 @@ if not os.is "windows" then
         end
     }
 
+    newaction
+    {
+        trigger     = "flood",
+        description = "Build and run connection request flood benchmark",
+        execute = function ()
+            os.execute "test ! -e Makefile && premake5 gmake"
+            if os.execute "make -j32 flood" == 0 then
+                os.execute "./bin/flood"
+            end
+        end
+    }
+
     newaction
     {
         trigger     = "cppcheck",
@@ -40,12 +40,14 @@ int ClientServerMain()
     uint8_t clientToServerKey[KeyBytes];
     uint8_t serverToClientKey[KeyBytes];
 
+    uint64_t connectTokenExpireTimestamp;
+
     int numServerAddresses;
     Address serverAddresses[MaxServersPerConnectToken];
 
     memset( connectTokenNonce, 0, NonceBytes );
 
-    if ( !matcher.RequestMatch( clientId, connectTokenData, connectTokenNonce, clientToServerKey, serverToClientKey, numServerAddresses, serverAddresses ) )
+    if ( !matcher.RequestMatch( clientId, connectTokenData, connectTokenNonce, clientToServerKey, serverToClientKey, connectTokenExpireTimestamp, numServerAddresses, serverAddresses ) )
     {
         printf( "error: request match failed\n" );
         return 1;
@@ -77,7 +79,7 @@ int ClientServerMain()
 
     server.Start();
     
-    client.Connect( serverAddress, connectTokenData, connectTokenNonce, clientToServerKey, serverToClientKey );
+    client.Connect( serverAddress, connectTokenData, connectTokenNonce, clientToServerKey, serverToClientKey, connectTokenExpireTimestamp );
 
     for ( int i = 0; i < NumIterations; ++i )
     {
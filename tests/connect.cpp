@@ -97,7 +97,9 @@ int ConnectMain( int argc, char * argv[] )
                     matchResponse.connectTokenData, 
                     matchResponse.connectTokenNonce, 
                     matchResponse.clientToServerKey,
-                    matchResponse.serverToClientKey );
+                    matchResponse.serverToClientKey,
+                    matchResponse.connectTokenExpireTimestamp,
+                    matchResponse.connectTokenServerId );
 
     double time = 0.0;
 
@@ -0,0 +1,138 @@
+/*
+    Connection Request Flood Benchmark
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define SERVER 1
+#define QUIET 1
+
+#include "shared.h"
+
+static const int NumFloodPackets = 1000000;
+
+class FloodServer : public GameServer
+{
+public:
+
+    explicit FloodServer( Allocator & allocator, Transport & transport ) : GameServer( allocator, transport ) {}
+
+    void Flood( const ConnectionRequestPacket & packet, const Address & from )
+    {
+        ProcessConnectionRequest( packet, from );
+    }
+};
+
+static void run_flood( const char * name, FloodServer & server, ConnectionRequestPacket & packet, int counterIndex, bool spoofSources = false )
+{
+    Address from( "::1", ClientPort );
+
+    const uint64_t rejectedBefore = server.GetCounter( counterIndex );
+    const uint64_t decryptedBefore = server.GetCounter( SERVER_COUNTER_CONNECT_TOKEN_FAILED_TO_DECRYPT );
+
+    const double startTime = platform_time();
+
+    for ( uint64_t i = 0; i < (uint64_t) NumFloodPackets; ++i )
+    {
+        memcpy( packet.connectTokenNonce, &i, NonceBytes );
+        if ( spoofSources )
+            from = Address( 10, (uint8_t) ( i >> 16 ), (uint8_t) ( i >> 8 ), (uint8_t) i, ClientPort );
+        server.Flood( packet, from );
+    }
+
+    const double elapsed = platform_time() - startTime;
+
+    const uint64_t rejected = server.GetCounter( counterIndex ) - rejectedBefore;
+    const uint64_t decrypted = server.GetCounter( SERVER_COUNTER_CONNECT_TOKEN_FAILED_TO_DECRYPT ) - decryptedBefore;
+
+    printf( "%-36s %8" PRId64 " rejected in %6.3f seconds -> %12.0f rejected requests per-second (%" PRId64 " decrypted)\n", name, rejected, elapsed, rejected / elapsed, decrypted );
+}
+
+int FloodMain()
+{
+    ClientServerPacketFactory packetFactory;
+
+    NetworkSimulator networkSimulator( GetDefaultAllocator() );
+
+    Address serverAddress( "::1", ServerPort );
+
+    SimulatorTransport serverTransport( GetDefaultAllocator(), networkSimulator, packetFactory, serverAddress, ProtocolId );
+
+    FloodServer server( GetDefaultAllocator(), serverTransport );
+
+    server.SetServerAddress( serverAddress );
+
+    server.Start();
+
+    ConnectionRequestPacket packet;
+
+    RandomBytes( packet.connectTokenData, ConnectTokenBytes );
+
+    const uint64_t timestamp = (uint64_t) time( NULL );
+
+    // expired connect tokens are rejected with an integer compare on the cleartext timestamp
+
+    packet.connectTokenProtocolId = ProtocolId;
+    packet.connectTokenExpireTimestamp = timestamp - 1;
+
+    run_flood( "expired connect tokens", server, packet, SERVER_COUNTER_CONNECT_TOKEN_EXPIRED );
+
+    // connect tokens for a different protocol are rejected the same way
+
+    packet.connectTokenProtocolId = ProtocolId + 1;
+    packet.connectTokenExpireTimestamp = timestamp + ConnectTokenExpirySeconds;
+
+    run_flood( "wrong protocol connect tokens", server, packet, SERVER_COUNTER_CONNECT_TOKEN_PROTOCOL_ID_MISMATCH );
+
+    // garbage connect tokens with a plausible timestamp cost a full decrypt to reject, but each source only gets a few
+
+    packet.connectTokenProtocolId = ProtocolId;
+    packet.connectTokenExpireTimestamp = timestamp + ConnectTokenExpirySeconds;
+
+    run_flood( "invalid connect tokens", server, packet, SERVER_COUNTER_CONNECTION_REQUEST_RATE_LIMITED );
+
+    // spoofing a different source address per-packet gets past the per-source limits, but only the decrypt budget is admitted
+
+    run_flood( "invalid connect tokens (spoofed)", server, packet, SERVER_COUNTER_CONNECTION_REQUEST_RATE_LIMITED, true );
+
+    server.Stop();
+
+    return 0;
+}
+
+int main()
+{
+    printf( "\nconnection request flood\n\n" );
+
+    if ( !InitializeYojimbo() )
+    {
+        printf( "error: failed to initialize Yojimbo!\n" );
+        return 1;
+    }
+
+    int result = FloodMain();
+
+    ShutdownYojimbo();
+
+    printf( "\n" );
+
+    return result;
+}
@@ -90,6 +90,8 @@ struct ClientData
     uint8_t clientToServerKey[KeyBytes];
     uint8_t serverToClientKey[KeyBytes];
 
+    uint64_t connectTokenExpireTimestamp;
+
     int numServerAddresses;
     Address serverAddresses[MaxServersPerConnectToken];
 
@@ -182,6 +184,7 @@ int ProfileMain()
                                     clientData[i].connectTokenNonce, 
                                     clientData[i].clientToServerKey, 
                                     clientData[i].serverToClientKey, 
+                                    clientData[i].connectTokenExpireTimestamp, 
                                     clientData[i].numServerAddresses, 
                                     clientData[i].serverAddresses ) )
         {
@@ -212,7 +215,8 @@ int ProfileMain()
                                        clientData[i].connectTokenData, 
                                        clientData[i].connectTokenNonce, 
                                        clientData[i].clientToServerKey, 
-                                       clientData[i].serverToClientKey );
+                                       clientData[i].serverToClientKey, 
+                                       clientData[i].connectTokenExpireTimestamp );
     }
 
     signal( SIGINT, interrupt_handler );    
@@ -361,8 +365,6 @@ int main()
 {
     printf( "\nprofile test\n\n" );
 
-    verbose_logging = true;
-
     if ( !InitializeYojimbo() )
     {
         printf( "error: failed to initialize Yojimbo!\n" );
@@ -42,7 +42,9 @@ const uint32_t ProtocolId = 0x12341651;
 const int ClientPort = 30000;
 const int ServerPort = 40000;
 
+#ifndef QUIET
 static bool verbose_logging = false;
+#endif // #ifndef QUIET
 
 inline int GetNumBitsForMessage( uint16_t sequence )
 {
@@ -128,7 +130,7 @@ public:
         m_nonce = 0;
     }
 
-    bool RequestMatch( uint64_t clientId, uint8_t * tokenData, uint8_t * tokenNonce, uint8_t * clientToServerKey, uint8_t * serverToClientKey, int & numServerAddresses, Address * serverAddresses )
+    bool RequestMatch( uint64_t clientId, uint8_t * tokenData, uint8_t * tokenNonce, uint8_t * clientToServerKey, uint8_t * serverToClientKey, uint64_t & connectTokenExpireTimestamp, int & numServerAddresses, Address * serverAddresses )
     {
         if ( clientId == 0 )
             return false;
@@ -142,7 +144,12 @@ public:
         memcpy( clientToServerKey, token.clientToServerKey, KeyBytes );
         memcpy( serverToClientKey, token.serverToClientKey, KeyBytes );
 
-        if ( !EncryptConnectToken( token, tokenData, NULL, 0, (const uint8_t*) &m_nonce, private_key ) )
+        connectTokenExpireTimestamp = token.expiryTimestamp;
+
+        uint8_t additionalData[ConnectTokenAdditionalDataBytes];
+        GenerateConnectTokenAdditionalData( token.protocolId, token.expiryTimestamp, token.serverId, additionalData );
+
+        if ( !EncryptConnectToken( token, tokenData, additionalData, ConnectTokenAdditionalDataBytes, (const uint8_t*) &m_nonce, private_key ) )
             return false;
 
         assert( NonceBytes == 8 );
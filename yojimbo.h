@@ -33,6 +33,9 @@
 #include "yojimbo_sockets.h"
 #include "yojimbo_matcher.h"
 #include "yojimbo_platform.h"
+#include "yojimbo_thread.h"
+#include "yojimbo_timer_wheel.h"
+#include "yojimbo_multiplexer.h"
 #include "yojimbo_simulator.h"
 #include "yojimbo_allocator.h"
 #include "yojimbo_encryption.h"
@@ -56,7 +56,9 @@ namespace yojimbo
         if ( !p )
             return NULL;
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
+        m_alloc_mutex.Acquire();
         m_alloc_map[p] = size;
+        m_alloc_mutex.Release();
 #endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
         return p;
     }
@@ -66,8 +68,10 @@ namespace yojimbo
         if ( !p )
             return;
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
+        m_alloc_mutex.Acquire();
         assert( m_alloc_map.find( p ) != m_alloc_map.end() );
         m_alloc_map.erase( p );
+        m_alloc_mutex.Release();
 #endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
         free( p );
     }
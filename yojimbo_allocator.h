@@ -29,6 +29,7 @@
 #include <new>
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
 #include <map>
+#include "yojimbo_thread.h"
 #endif // YOJIMBO_DEBUG_MEMORY_LEAKS
 
 namespace yojimbo
@@ -71,6 +72,7 @@ namespace yojimbo
     {
 #if YOJIMBO_DEBUG_MEMORY_LEAKS
         std::map<void*,uint32_t> m_alloc_map;
+        Mutex m_alloc_mutex;                        // malloc is thread safe, the leak map isn't. lets per-client work run on worker threads.
 #endif // #if YOJIMBO_DEBUG_MEMORY_LEAKS
 
     public:
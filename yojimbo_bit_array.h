@@ -26,6 +26,7 @@
 #define YOJIMBO_BIT_ARRAY_H
 
 #include "yojimbo_allocator.h"
+#include "yojimbo_common.h"
 
 namespace yojimbo
 {
@@ -90,6 +91,50 @@ namespace yojimbo
             return ( m_data[data_index] >> bit_index ) & 1;
         }
 
+        int FindFirstClear( int start = 0 ) const
+        {
+            // returns the index of the first clear bit at or after start, or -1 if every bit from start onwards is set.
+            // scans a word at a time, so runs of set bits are skipped 64 at a time.
+
+            assert( start >= 0 );
+            assert( start <= m_size );
+
+            if ( start >= m_size )
+                return -1;
+
+            const int numWords = m_bytes / 8;
+
+            int data_index = start >> 6;
+
+            uint64_t word = ~m_data[data_index] & ( ~uint64_t(0) << ( start & ( (1<<6) - 1 ) ) );
+
+            while ( word == 0 )
+            {
+                if ( ++data_index == numWords )
+                    return -1;
+
+                word = ~m_data[data_index];
+            }
+
+            // IMPORTANT: padding bits past the end of the array are never set, so they show up as clear here
+
+            const int index = ( data_index << 6 ) + trailing_zeros64( word );
+
+            return index < m_size ? index : -1;
+        }
+
+        int GetPopCount() const
+        {
+            const int numWords = m_bytes / 8;
+
+            int count = 0;
+
+            for ( int i = 0; i < numWords; ++i )
+                count += popcount64( m_data[i] );
+
+            return count;
+        }
+
         int GetSize() const
         {
             return m_size;
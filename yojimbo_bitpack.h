@@ -124,6 +124,66 @@ namespace yojimbo
             assert( headBytes + numWords * 4 + tailBytes == bytes );
         }
 
+        void WriteBitStream( const uint32_t * data, int bitOffset, int bits )
+        {
+            // copy a run of bits from a buffer in the same format this writer produces, starting at any bit offset.
+            // whole words are funnel shifted from two source words at a time, instead of going through WriteBits 32 bits at a time.
+
+            assert( data );
+            assert( bitOffset >= 0 );
+            assert( bits >= 0 );
+            assert( m_bitsWritten + bits <= m_numBits );
+
+            data += bitOffset / 32;
+
+            const int shift = bitOffset % 32;
+            const int numWords = bits / 32;
+            const int tailBits = bits - numWords * 32;
+
+            if ( numWords > 0 )
+            {
+                uint32_t * output = m_data + m_wordIndex;
+
+                if ( shift == 0 && m_scratchBits == 0 )
+                {
+                    memcpy( output, data, numWords * 4 );
+                }
+                else if ( shift == 0 )
+                {
+                    for ( int i = 0; i < numWords; ++i )
+                    {
+                        m_scratch |= uint64_t( network_to_host( data[i] ) ) << m_scratchBits;
+                        output[i] = host_to_network( uint32_t( m_scratch & 0xFFFFFFFF ) );
+                        m_scratch >>= 32;
+                    }
+                }
+                else
+                {
+                    for ( int i = 0; i < numWords; ++i )
+                    {
+                        const uint64_t input = uint64_t( network_to_host( data[i] ) ) | ( uint64_t( network_to_host( data[i+1] ) ) << 32 );
+                        m_scratch |= ( ( input >> shift ) & 0xFFFFFFFF ) << m_scratchBits;
+                        output[i] = host_to_network( uint32_t( m_scratch & 0xFFFFFFFF ) );
+                        m_scratch >>= 32;
+                    }
+                }
+
+                m_wordIndex += numWords;
+                m_bitsWritten += numWords * 32;
+            }
+
+            if ( tailBits > 0 )
+            {
+                // IMPORTANT: only touch the second source word if the tail bits actually extend into it
+
+                uint64_t input = network_to_host( data[numWords] );
+                if ( shift + tailBits > 32 )
+                    input |= uint64_t( network_to_host( data[numWords+1] ) ) << 32;
+
+                WriteBits( uint32_t( input >> shift ), tailBits );
+            }
+        }
+
         void FlushBits()
         {
             if ( m_scratchBits != 0 )
@@ -282,6 +342,47 @@ namespace yojimbo
             assert( headBytes + numWords * 4 + tailBytes == bytes );
         }
 
+        void ReadBitStream( uint32_t * data, int bits )
+        {
+            // read a run of bits into a buffer in the same format the bit writer produces, starting at bit zero.
+            // unused bits in the last word are cleared, so the result can be passed straight to BitWriter::WriteBitStream.
+
+            assert( data );
+            assert( bits >= 0 );
+            assert( m_bitsRead + bits <= m_numBits );
+            assert( m_scratchBits >= 0 && m_scratchBits < 32 );
+
+            const int numWords = bits / 32;
+            const int tailBits = bits - numWords * 32;
+
+            if ( numWords > 0 )
+            {
+                assert( m_wordIndex + numWords <= m_numWords );
+
+                if ( m_scratchBits == 0 )
+                {
+                    memcpy( data, &m_data[m_wordIndex], numWords * 4 );
+                }
+                else
+                {
+                    const uint32_t * input = m_data + m_wordIndex;
+
+                    for ( int i = 0; i < numWords; ++i )
+                    {
+                        m_scratch |= uint64_t( network_to_host( input[i] ) ) << m_scratchBits;
+                        data[i] = host_to_network( uint32_t( m_scratch & 0xFFFFFFFF ) );
+                        m_scratch >>= 32;
+                    }
+                }
+
+                m_wordIndex += numWords;
+                m_bitsRead += numWords * 32;
+            }
+
+            if ( tailBits > 0 )
+                data[numWords] = host_to_network( ReadBits( tailBits ) );
+        }
+
         int GetAlignBits() const
         {
             return ( 8 - m_bitsRead % 8 ) % 8;
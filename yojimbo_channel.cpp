@@ -42,25 +42,40 @@ namespace yojimbo
 
                 allocator.Free( message.messages );
                 message.messages = NULL;
+                message.messageIds = NULL;
             }
         }
         else
         {
-            if ( block.message )
+            if ( block.numPacketFragments > 0 )
             {
-                messageFactory.Release( block.message );
-                block.message = NULL;
-            }
+                for ( int i = 0; i < block.numPacketFragments; ++i )
+                {
+                    BlockFragmentData & fragment = block.fragments[i];
 
-            if ( block.fragmentData )
-            {
-                allocator.Free( block.fragmentData );
-                block.fragmentData = NULL;
+                    if ( fragment.message )
+                    {
+                        messageFactory.Release( fragment.message );
+                        fragment.message = NULL;
+                    }
+
+                    if ( fragment.ownsFragmentData )
+                    {
+                        allocator.Free( fragment.fragmentData );
+                        fragment.ownsFragmentData = false;
+                    }
+
+                    fragment.fragmentData = NULL;
+                }
+
+                allocator.Free( block.fragments );
+                block.fragments = NULL;
+                block.numPacketFragments = 0;
             }
         }
     }
 
-    template <typename Stream> bool SerializeOrderedMessages( Stream & stream, MessageFactory & messageFactory, int & numMessages, Message ** & messages, int maxMessagesPerPacket )
+    template <typename Stream> bool SerializeOrderedMessages( Stream & stream, MessageFactory & messageFactory, int & numMessages, Message ** & messages, const uint16_t * sendMessageIds, int maxMessagesPerPacket )
     {
         const int maxMessageType = messageFactory.GetNumTypes() - 1;
 
@@ -87,7 +102,7 @@ namespace yojimbo
                 {
                     assert( messages[i] );
                     messageTypes[i] = messages[i]->GetType();
-                    messageIds[i] = messages[i]->GetId();
+                    messageIds[i] = sendMessageIds ? sendMessageIds[i] : messages[i]->GetId();
                 }
             }
             else
@@ -228,7 +243,7 @@ namespace yojimbo
         return true;
     }
 
-    template <typename Stream> bool SerializeBlockFragment( Stream & stream, MessageFactory & messageFactory, ChannelPacketData::BlockData & block, const ChannelConfig & channelConfig )
+    template <typename Stream> bool SerializeBlockFragment( Stream & stream, MessageFactory & messageFactory, ChannelPacketData::BlockFragmentData & block, const ChannelConfig & channelConfig )
     {
         const int maxMessageType = messageFactory.GetNumTypes() - 1;
 
@@ -253,6 +268,8 @@ namespace yojimbo
 
             if ( !block.fragmentData )
                 return false;
+
+            block.ownsFragmentData = true;
         }
 
         serialize_bytes( stream, block.fragmentData, block.fragmentSize );
@@ -304,11 +321,24 @@ namespace yojimbo
 
         if ( !blockMessage )
         {
+            if ( Stream::IsReading )
+                message.messageIds = NULL;
+
             switch ( channelConfig.type )
             {
                 case CHANNEL_TYPE_RELIABLE_ORDERED:
+                case CHANNEL_TYPE_RELIABLE_UNORDERED:
                 {
-                    if ( !SerializeOrderedMessages( stream, messageFactory, message.numMessages, message.messages, channelConfig.maxMessagesPerPacket ) )
+                    if ( !SerializeOrderedMessages( stream, messageFactory, message.numMessages, message.messages, message.messageIds, channelConfig.maxMessagesPerPacket ) )
+                        return false;
+                }
+                break;
+
+                case CHANNEL_TYPE_UNRELIABLE_SEQUENCED:
+                {
+                    serialize_bits( stream, message.sequence, 16 );
+
+                    if ( !SerializeUnorderedMessages( stream, messageFactory, message.numMessages, message.messages, channelConfig.maxMessagesPerPacket, channelConfig.maxBlockSize ) )
                         return false;
                 }
                 break;
@@ -333,8 +363,31 @@ namespace yojimbo
             if ( channelConfig.disableBlocks )
                 return false;
 
-            if ( !SerializeBlockFragment( stream, messageFactory, block, channelConfig ) )
-                return false;
+            int numPacketFragments = Stream::IsWriting ? block.numPacketFragments : 1;
+
+            if ( Stream::IsReading )
+                block.numPacketFragments = 0;
+
+            if ( channelConfig.maxFragmentsPerPacket > 1 )
+                serialize_int( stream, numPacketFragments, 1, channelConfig.maxFragmentsPerPacket );
+
+            if ( Stream::IsReading )
+            {
+                block.fragments = (BlockFragmentData*) messageFactory.GetAllocator().Allocate( sizeof( BlockFragmentData ) * numPacketFragments );
+
+                if ( !block.fragments )
+                    return false;
+
+                memset( block.fragments, 0, sizeof( BlockFragmentData ) * numPacketFragments );
+
+                block.numPacketFragments = numPacketFragments;
+            }
+
+            for ( int i = 0; i < block.numPacketFragments; ++i )
+            {
+                if ( !SerializeBlockFragment( stream, messageFactory, block.fragments[i], channelConfig ) )
+                    return false;
+            }
         }
 
         return true;
@@ -370,24 +423,41 @@ namespace yojimbo
 
         m_listener = NULL;
 
+        m_context = NULL;
+
         m_messageSendQueue = YOJIMBO_NEW( *m_allocator, SequenceBuffer<MessageSendQueueEntry>, *m_allocator, m_config.sendQueueSize );
+        m_messageResendQueue = YOJIMBO_NEW( *m_allocator, Queue<MessageResendEntry>, *m_allocator, m_config.sendQueueSize );
         
         m_messageSentPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<MessageSentPacketEntry>, *m_allocator, m_config.sentPacketBufferSize );
         
         m_messageReceiveQueue = YOJIMBO_NEW( *m_allocator, SequenceBuffer<MessageReceiveQueueEntry>, *m_allocator, m_config.receiveQueueSize );
         
-        m_sentPacketMessageIds = (uint16_t*) m_allocator->Allocate( sizeof( uint16_t ) * m_config.maxMessagesPerPacket * m_config.sendQueueSize );
+        m_sentPacketMessageIds = (uint16_t*) m_allocator->Allocate( sizeof( uint16_t ) * m_config.maxMessagesPerPacket * m_config.sentPacketBufferSize );
 
         if ( !config.disableBlocks )
         {
-            m_sendBlock = YOJIMBO_NEW( *m_allocator, SendBlockData, *m_allocator, m_config.maxBlockSize, m_config.GetMaxFragmentsPerBlock() );
+            assert( m_config.maxFragmentsPerPacket >= 1 );
+            assert( m_config.maxFragmentsPerPacket < ( 1 << 14 ) );
+            assert( m_config.maxBlocksInFlight >= 1 );
+
+            m_sentPacketFragments = (MessageSentFragmentEntry*) m_allocator->Allocate( sizeof( MessageSentFragmentEntry ) * m_config.maxFragmentsPerPacket * m_config.sentPacketBufferSize );
+
+            m_sendBlocks = (SendBlockData**) m_allocator->Allocate( sizeof( SendBlockData* ) * m_config.maxBlocksInFlight );
+
+            m_receiveBlocks = (ReceiveBlockData**) m_allocator->Allocate( sizeof( ReceiveBlockData* ) * m_config.maxBlocksInFlight );
+
+            for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
+            {
+                m_sendBlocks[i] = YOJIMBO_NEW( *m_allocator, SendBlockData, *m_allocator );
             
-            m_receiveBlock = YOJIMBO_NEW( *m_allocator, ReceiveBlockData, *m_allocator, m_config.maxBlockSize, m_config.GetMaxFragmentsPerBlock() );
+                m_receiveBlocks[i] = YOJIMBO_NEW( *m_allocator, ReceiveBlockData, *m_allocator );
+            }
         }
         else
         {
-            m_sendBlock = NULL;
-            m_receiveBlock = NULL;
+            m_sentPacketFragments = NULL;
+            m_sendBlocks = NULL;
+            m_receiveBlocks = NULL;
         }
 
         Reset();
@@ -397,9 +467,25 @@ namespace yojimbo
     {
         Reset();
 
-        YOJIMBO_DELETE( *m_allocator, SendBlockData, m_sendBlock );
-        YOJIMBO_DELETE( *m_allocator, ReceiveBlockData, m_receiveBlock );
+        if ( !m_config.disableBlocks )
+        {
+            for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
+            {
+                YOJIMBO_DELETE( *m_allocator, SendBlockData, m_sendBlocks[i] );
+                YOJIMBO_DELETE( *m_allocator, ReceiveBlockData, m_receiveBlocks[i] );
+            }
+
+            m_allocator->Free( m_sendBlocks );
+            m_allocator->Free( m_receiveBlocks );
+            m_allocator->Free( m_sentPacketFragments );
+
+            m_sendBlocks = NULL;
+            m_receiveBlocks = NULL;
+            m_sentPacketFragments = NULL;
+        }
+
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<MessageSendQueueEntry>, m_messageSendQueue );
+        YOJIMBO_DELETE( *m_allocator, Queue<MessageResendEntry>, m_messageResendQueue );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<MessageSentPacketEntry>, m_messageSentPackets );
         YOJIMBO_DELETE( *m_allocator, SequenceBuffer<MessageReceiveQueueEntry>, m_messageReceiveQueue );
         
@@ -414,9 +500,13 @@ namespace yojimbo
 
         m_time = 0.0;
 
+        m_messageResendTime = m_config.messageResendTime;
+        m_fragmentResendTime = m_config.fragmentResendTime;
+
         m_sendMessageId = 0;
         m_receiveMessageId = 0;
         m_oldestUnackedMessageId = 0;
+        m_unsentMessageId = 0;
 
         for ( int i = 0; i < m_messageSendQueue->GetSize(); ++i )
         {
@@ -433,22 +523,29 @@ namespace yojimbo
         }
 
         m_messageSendQueue->Reset();
+        m_messageResendQueue->Clear();
         m_messageSentPackets->Reset();
         m_messageReceiveQueue->Reset();
 
-        if ( m_sendBlock )
+        if ( !m_config.disableBlocks )
         {
-            m_sendBlock->Reset();
-        }
+            for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
+            {
+                m_sendBlocks[i]->Reset();
 
-        if ( m_receiveBlock )
-        {
-            m_receiveBlock->Reset();
+                m_receiveBlocks[i]->Reset();
 
-            if ( m_receiveBlock->blockMessage )
-            {
-                m_messageFactory->Release( m_receiveBlock->blockMessage );
-                m_receiveBlock->blockMessage = NULL;
+                if ( m_receiveBlocks[i]->blockMessage )
+                {
+                    m_messageFactory->Release( m_receiveBlocks[i]->blockMessage );
+                    m_receiveBlocks[i]->blockMessage = NULL;
+                }
+
+                if ( m_receiveBlocks[i]->blockData )
+                {
+                    m_messageFactory->GetAllocator().Free( m_receiveBlocks[i]->blockData );
+                    m_receiveBlocks[i]->blockData = NULL;
+                }
             }
         }
 
@@ -489,7 +586,32 @@ namespace yojimbo
             return;
         }
 
-        message->AssignId( m_sendMessageId );
+        // serialize the message once up front, so packets copy its bits instead of calling the message serialize function on every send.
+        // the wire format is unchanged. if the message can't be captured, it is queued as is and serialized per-packet as usual.
+        // IMPORTANT: the message is captured with the connection's serialization context, so it sees the same context as when
+        // it is serialized into a packet. without a context there is nothing safe to capture with, so the message is not cached.
+
+        if ( m_config.cacheMessageBits && m_context && !message->IsBlockMessage() && !message->IsSharedMessage() )
+        {
+            Allocator & allocator = m_messageFactory->GetAllocator();
+
+            SharedMessage * cachedMessage = YOJIMBO_NEW( allocator, SharedMessage, allocator );
+
+            if ( cachedMessage->Capture( *message, m_context ) )
+            {
+                m_messageFactory->Release( message );
+                message = cachedMessage;
+            }
+            else
+            {
+                m_messageFactory->Release( cachedMessage );
+            }
+        }
+
+        // a shared message is queued on many channels at once, each with its own id. those ids are written from the packet data instead.
+
+        if ( !message->IsSharedMessage() )
+            message->AssignId( m_sendMessageId );
 
         MessageSendQueueEntry * entry = m_messageSendQueue->Insert( m_sendMessageId );
 
@@ -551,21 +673,22 @@ namespace yojimbo
         {
             if ( SendingBlockMessage() )
             {
-                uint16_t messageId;
-                uint16_t fragmentId;
-                int fragmentBytes;
-                int numFragments;
-                int messageType;
+                int numFragments = 0;
+
+                MessageSentFragmentEntry * fragments = (MessageSentFragmentEntry*) alloca( m_config.maxFragmentsPerPacket * sizeof( MessageSentFragmentEntry ) );
 
-                uint8_t * fragmentData = GetFragmentToSend( messageId, fragmentId, fragmentBytes, numFragments, messageType );
+                GetFragmentsToSend( fragments, numFragments, availableBits );
 
-                if ( fragmentData )
+                if ( numFragments > 0 )
                 {
-                    const int fragmentBits = GetFragmentPacketData( packetData, messageId, fragmentId, fragmentData, fragmentBytes, numFragments, messageType );
+                    const int fragmentBits = GetFragmentPacketData( packetData, fragments, numFragments );
 
-                    AddFragmentPacketEntry( messageId, fragmentId, packetSequence );
+                    if ( numFragments > 0 )
+                    {
+                        AddFragmentPacketEntry( fragments, numFragments, packetSequence );
 
-                    return fragmentBits;
+                        return fragmentBits;
+                    }
                 }
             }
             else
@@ -610,67 +733,157 @@ namespace yojimbo
 
         const int messageLimit = min( m_config.sendQueueSize, m_config.receiveQueueSize );
 
-        uint16_t previousMessageId = 0;
-
         int usedBits = ConservativeMessageHeaderEstimate;
 
-        int giveUpCounter = 0;
+        // message ids are kept sorted relative to the oldest unacked message, since they are serialized relative to each other.
+        // inserting an id only changes the relative id bits of its neighbours, so the packet cost stays exact as messages are added.
 
-        for ( int i = 0; i < messageLimit; ++i )
-        {
-            if ( availableBits - usedBits < giveUpBits )
-                break;
+        const uint16_t baseMessageId = m_oldestUnackedMessageId;
 
-            if ( giveUpCounter > m_config.sendQueueSize )
-                break;
+        bool resending = true;
 
-            uint16_t messageId = m_oldestUnackedMessageId + i;
+        while ( numMessageIds < m_config.maxMessagesPerPacket && availableBits - usedBits >= giveUpBits )
+        {
+            uint16_t messageId;
 
-            MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
+            MessageSendQueueEntry * entry;
 
-            if ( !entry )
-                continue;
+            if ( resending )
+            {
+                // resend messages that are due, oldest send first. stop at the first message that isn't due yet, since the rest were sent after it.
 
-            if ( entry->block )
-                break;
-            
-            if ( entry->timeLastSent + m_config.messageResendTime <= m_time && availableBits >= (int) entry->measuredBits )
-            {                
-                int messageBits = entry->measuredBits + messageTypeBits;
-                
-                if ( numMessageIds == 0 )
+                if ( m_messageResendQueue->IsEmpty() )
                 {
-                    messageBits += 16;
+                    resending = false;
+                    continue;
                 }
-                else
+
+                const MessageResendEntry & resendEntry = (*m_messageResendQueue)[0];
+
+                messageId = resendEntry.messageId;
+
+                entry = m_messageSendQueue->Find( messageId );
+
+                if ( !entry || entry->timeLastSent != resendEntry.timeSent )
                 {
-                    MeasureStream stream;
-                    serialize_sequence_relative_internal( stream, previousMessageId, messageId );
-                    messageBits += stream.GetBitsProcessed();
+                    m_messageResendQueue->Pop();
+                    continue;
                 }
 
-                if ( usedBits + messageBits > availableBits )
+                if ( entry->timeLastSent + m_messageResendTime > m_time )
                 {
-                    giveUpCounter++;
+                    resending = false;
                     continue;
                 }
+            }
+            else
+            {
+                // then send messages that have never been sent, in id order. messages queued behind a block wait until the block is acked.
 
-                usedBits += messageBits;
+                if ( m_unsentMessageId == m_sendMessageId )
+                    break;
 
-                messageIds[numMessageIds++] = messageId;
-                
-                entry->timeLastSent = m_time;
+                messageId = m_unsentMessageId;
+
+                entry = m_messageSendQueue->Find( messageId );
+
+                if ( !entry )
+                {
+                    m_unsentMessageId++;
+                    continue;
+                }
 
-                previousMessageId = messageId;
+                if ( entry->block )
+                    break;
+
+                if ( uint16_t( messageId - baseMessageId ) >= messageLimit )
+                    break;
             }
 
-            if ( numMessageIds == m_config.maxMessagesPerPacket )
+            const uint16_t offset = messageId - baseMessageId;
+
+            int index = numMessageIds;
+
+            while ( index > 0 && uint16_t( messageIds[index-1] - baseMessageId ) > offset )
+                index--;
+
+            int idBits;
+
+            if ( numMessageIds == 0 )
+                idBits = 16;
+            else if ( index == 0 )
+                idBits = sequence_relative_bits( messageId, messageIds[0] );
+            else if ( index == numMessageIds )
+                idBits = sequence_relative_bits( messageIds[index-1], messageId );
+            else
+                idBits = sequence_relative_bits( messageIds[index-1], messageId ) + sequence_relative_bits( messageId, messageIds[index] ) - sequence_relative_bits( messageIds[index-1], messageIds[index] );
+
+            const int messageBits = entry->measuredBits + messageTypeBits + idBits;
+
+            if ( usedBits + messageBits > availableBits )
+            {
+                if ( resending )
+                {
+                    resending = false;
+                    continue;
+                }
+
                 break;
+            }
+
+            usedBits += messageBits;
+
+            for ( int i = numMessageIds; i > index; --i )
+                messageIds[i] = messageIds[i-1];
+
+            messageIds[index] = messageId;
+
+            numMessageIds++;
+
+            if ( resending )
+                m_messageResendQueue->Pop();
+            else
+                m_unsentMessageId++;
+
+            entry->timeLastSent = m_time;
+        }
+
+        // queue the sent messages for resend after the loop, so a message can't be picked twice for the same packet
+
+        for ( int i = 0; i < numMessageIds; ++i )
+        {
+            if ( m_messageResendQueue->IsFull() )
+                CompactMessageResendQueue();
+
+            MessageResendEntry resendEntry;
+            resendEntry.timeSent = m_time;
+            resendEntry.messageId = messageIds[i];
+
+            m_messageResendQueue->Push( resendEntry );
         }
 
         return usedBits;
     }
 
+    void ReliableOrderedChannel::CompactMessageResendQueue()
+    {
+        // drop entries for messages that have since been acked or resent. at most one entry per message in the send queue survives.
+
+        const int numEntries = m_messageResendQueue->GetNumEntries();
+
+        for ( int i = 0; i < numEntries; ++i )
+        {
+            const MessageResendEntry resendEntry = m_messageResendQueue->Pop();
+
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( resendEntry.messageId );
+
+            if ( entry && entry->timeLastSent == resendEntry.timeSent )
+                m_messageResendQueue->Push( resendEntry );
+        }
+
+        assert( !m_messageResendQueue->IsFull() );
+    }
+
     void ReliableOrderedChannel::GetMessagePacketData( ChannelPacketData & packetData, const uint16_t * messageIds, int numMessageIds )
     {
         assert( messageIds );
@@ -684,13 +897,18 @@ namespace yojimbo
         if ( numMessageIds == 0 )
             return;
 
-        packetData.message.messages = (Message**) m_messageFactory->GetAllocator().Allocate( sizeof( Message* ) * numMessageIds );
+        // message ids are stored after the message pointers in the same allocation, so they are freed along with them
+
+        packetData.message.messages = (Message**) m_messageFactory->GetAllocator().Allocate( ( sizeof( Message* ) + sizeof( uint16_t ) ) * numMessageIds );
+
+        packetData.message.messageIds = (uint16_t*) ( packetData.message.messages + numMessageIds );
 
         for ( int i = 0; i < numMessageIds; ++i )
         {
             MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageIds[i] );
             assert( entry );
             packetData.message.messages[i] = entry->message;
+            packetData.message.messageIds[i] = messageIds[i];
             m_messageFactory->AddRef( packetData.message.messages[i] );
         }
     }
@@ -754,7 +972,15 @@ namespace yojimbo
 
         if ( packetData.blockMessage )
         {
-            ProcessPacketFragment( packetData.block.messageType, packetData.block.messageId, packetData.block.numFragments, packetData.block.fragmentId, packetData.block.fragmentData, packetData.block.fragmentSize, packetData.block.message );
+            for ( int i = 0; i < packetData.block.numPacketFragments; ++i )
+            {
+                const ChannelPacketData::BlockFragmentData & fragment = packetData.block.fragments[i];
+
+                ProcessPacketFragment( fragment.messageType, fragment.messageId, fragment.numFragments, fragment.fragmentId, fragment.fragmentData, fragment.fragmentSize, fragment.message );
+
+                if ( GetError() != CHANNEL_ERROR_NONE )
+                    return;
+            }
         }
         else
         {
@@ -780,7 +1006,7 @@ namespace yojimbo
             if ( sendQueueEntry )
             {
                 assert( sendQueueEntry->message );
-                assert( sendQueueEntry->message->GetId() == messageId );
+                assert( sendQueueEntry->message->IsSharedMessage() || sendQueueEntry->message->GetId() == messageId );
 
                 m_messageFactory->Release( sendQueueEntry->message );
 
@@ -790,20 +1016,39 @@ namespace yojimbo
             }
         }
 
-        if ( !m_config.disableBlocks && sentPacketEntry->block && m_sendBlock->active && m_sendBlock->blockMessageId == sentPacketEntry->blockMessageId )
-        {        
-            const int messageId = sentPacketEntry->blockMessageId;
-            const int fragmentId = sentPacketEntry->blockFragmentId;
-
-            if ( !m_sendBlock->ackedFragment->GetBit( fragmentId ) )
+        if ( !m_config.disableBlocks && sentPacketEntry->block )
+        {
+            for ( int i = 0; i < (int) sentPacketEntry->numFragments; ++i )
             {
-                m_sendBlock->ackedFragment->SetBit( fragmentId );
+                const uint16_t messageId = sentPacketEntry->fragments[i].messageId;
+                const int fragmentId = sentPacketEntry->fragments[i].fragmentId;
+
+                SendBlockData * sendBlock = GetSendBlock( messageId );
+
+                if ( !sendBlock->active || sendBlock->blockMessageId != messageId )
+                    continue;
+
+                if ( sendBlock->ackedFragment->GetBit( fragmentId ) )
+                    continue;
+
+                sendBlock->ackedFragment->SetBit( fragmentId );
 
-                m_sendBlock->numAckedFragments++;
+                sendBlock->numAckedFragments++;
 
-                if ( m_sendBlock->numAckedFragments == m_sendBlock->numFragments )
+                if ( fragmentId == sendBlock->firstUnackedFragmentId )
                 {
-                    m_sendBlock->active = false;
+                    const int firstUnackedFragmentId = sendBlock->ackedFragment->FindFirstClear( fragmentId );
+
+                    sendBlock->firstUnackedFragmentId = ( firstUnackedFragmentId >= 0 && firstUnackedFragmentId < sendBlock->numFragments ) ? firstUnackedFragmentId : sendBlock->numFragments;
+                }
+
+                if ( sendBlock->numAckedFragments == sendBlock->numFragments )
+                {
+                    assert( sendBlock->ackedFragment->GetPopCount() == sendBlock->numFragments );
+
+                    sendBlock->active = false;
+
+                    sendBlock->FreeFragments();
 
                     MessageSendQueueEntry * sendQueueEntry = m_messageSendQueue->Find( messageId );
 
@@ -819,6 +1064,17 @@ namespace yojimbo
         }
     }
 
+    void ReliableOrderedChannel::UpdateRTT( double rtt, double rttVariance )
+    {
+        if ( !m_config.adaptiveResendTime )
+            return;
+
+        const double resendTime = clamp( rtt + 4.0 * rttVariance, (double) m_config.minResendTime, (double) m_config.maxResendTime );
+
+        m_messageResendTime = resendTime;
+        m_fragmentResendTime = resendTime;
+    }
+
     void ReliableOrderedChannel::UpdateOldestUnackedMessageId()
     {
         const uint16_t stopMessageId = m_messageSendQueue->GetSequence();
@@ -847,122 +1103,267 @@ namespace yojimbo
         return entry ? entry->block : false;
     }
 
-    uint8_t * ReliableOrderedChannel::GetFragmentToSend( uint16_t & messageId, uint16_t & fragmentId, int & fragmentBytes, int & numFragments, int & messageType )
+    static int next_unacked_fragment( const SendBlockData & sendBlock, int start, int end )
     {
-        MessageSendQueueEntry * entry = m_messageSendQueue->Find( m_oldestUnackedMessageId );
+        // fragments at or past end don't count. they haven't been sent yet, or are past the end of this block since the acked bit array is sized for the largest block.
+        // wraps around to the first unacked fragment.
 
-        assert( entry );
-        assert( entry->block );
+        int fragmentId = ( start < end ) ? sendBlock.ackedFragment->FindFirstClear( start ) : -1;
 
-        BlockMessage * blockMessage = (BlockMessage*) entry->message;
+        if ( fragmentId < 0 || fragmentId >= end )
+            fragmentId = sendBlock.ackedFragment->FindFirstClear( sendBlock.firstUnackedFragmentId );
 
-        assert( blockMessage );
+        return ( fragmentId >= 0 && fragmentId < end ) ? fragmentId : -1;
+    }
 
-        messageId = blockMessage->GetId();
+    SendBlockData * ReliableOrderedChannel::GetSendBlock( uint16_t messageId )
+    {
+        assert( !m_config.disableBlocks );
 
-        const int blockSize = blockMessage->GetBlockSize();
+        // blocks in flight have consecutive message ids, so they never share a slot
 
-        if ( !m_sendBlock->active )
-        {
-            // start sending this block
+        return m_sendBlocks[messageId % m_config.maxBlocksInFlight];
+    }
+
+    ReceiveBlockData * ReliableOrderedChannel::GetReceiveBlock( uint16_t messageId )
+    {
+        assert( !m_config.disableBlocks );
+
+        return m_receiveBlocks[messageId % m_config.maxBlocksInFlight];
+    }
+
+    int ReliableOrderedChannel::GetFragmentBytes( const SendBlockData & sendBlock, int fragmentId ) const
+    {
+        const int fragmentRemainder = sendBlock.blockSize % m_config.fragmentSize;
+
+        if ( fragmentRemainder && fragmentId == sendBlock.numFragments - 1 )
+            return fragmentRemainder;
+
+        return m_config.fragmentSize;
+    }
 
-            m_sendBlock->active = true;
-            m_sendBlock->blockSize = blockSize;
-            m_sendBlock->blockMessageId = messageId;
-            m_sendBlock->numFragments = (int) ceil( blockSize / float( m_config.fragmentSize ) );
-            m_sendBlock->numAckedFragments = 0;
+    int ReliableOrderedChannel::GetFragmentBits( uint16_t messageId, int fragmentId, int fragmentBytes )
+    {
+        int fragmentBits = ConservativeFragmentHeaderEstimate + fragmentBytes * 8;
 
-            const int MaxFragmentsPerBlock = m_config.GetMaxFragmentsPerBlock();
+        if ( fragmentId == 0 )
+        {
+            // the block message is sent along with fragment 0
 
-            assert( m_sendBlock->numFragments > 0 );
-            assert( m_sendBlock->numFragments <= MaxFragmentsPerBlock );
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
 
-            m_sendBlock->ackedFragment->Clear();
+            assert( entry );
 
-            for ( int i = 0; i < MaxFragmentsPerBlock; ++i )
-                m_sendBlock->fragmentSendTime[i] = -1.0;
+            fragmentBits += entry->measuredBits + bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
         }
 
-        numFragments = m_sendBlock->numFragments;
+        return fragmentBits;
+    }
+
+    void ReliableOrderedChannel::GetFragmentsToSend( MessageSentFragmentEntry * fragments, int & numFragments, int availableBits )
+    {
+        assert( SendingBlockMessage() );
+
+        numFragments = 0;
 
-        // find the next fragment to send (there may not be one)
+        int usedBits = 0;
 
-        fragmentId = 0xFFFF;
+        // walk the consecutive block messages at the front of the send queue, up to the number of blocks allowed in flight.
+        // a block only starts once every fragment of the block before it has been sent, so new blocks fill in behind trailing resends.
 
-        for ( int i = 0; i < m_sendBlock->numFragments; ++i )
+        for ( int i = 0; i < m_config.maxBlocksInFlight; ++i )
         {
-            if ( !m_sendBlock->ackedFragment->GetBit( i ) && m_sendBlock->fragmentSendTime[i] + m_config.fragmentResendTime < m_time )
-            {
-                fragmentId = uint16_t( i );
+            const uint16_t messageId = m_oldestUnackedMessageId + i;
+
+            if ( messageId == m_sendMessageId )
+                break;
+
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
+
+            if ( !entry )
+                continue;
+
+            if ( !entry->block )
                 break;
+
+            SendBlockData * sendBlock = GetSendBlock( messageId );
+
+            if ( !sendBlock->active )
+            {
+                if ( i > 0 )
+                {
+                    SendBlockData * previousSendBlock = GetSendBlock( messageId - 1 );
+
+                    if ( previousSendBlock->active && previousSendBlock->numSentFragments < previousSendBlock->numFragments )
+                        break;
+                }
+
+                // start sending this block
+
+                BlockMessage * blockMessage = (BlockMessage*) entry->message;
+
+                assert( blockMessage );
+
+                const int blockSize = blockMessage->GetBlockSize();
+
+                const int blockNumFragments = ( blockSize + m_config.fragmentSize - 1 ) / m_config.fragmentSize;
+
+                assert( blockNumFragments > 0 );
+                assert( blockNumFragments <= m_config.GetMaxFragmentsPerBlock() );
+
+                if ( !sendBlock->AllocateFragments( blockNumFragments ) )
+                {
+                    SetError( CHANNEL_ERROR_OUT_OF_MEMORY );
+                    return;
+                }
+
+                sendBlock->active = true;
+                sendBlock->blockSize = blockSize;
+                sendBlock->blockMessageId = messageId;
+                sendBlock->numFragments = blockNumFragments;
+                sendBlock->numAckedFragments = 0;
+                sendBlock->numSentFragments = 0;
+
+                for ( int j = 0; j < sendBlock->numFragments; ++j )
+                    sendBlock->fragmentSendTime[j] = -1.0;
+
+                sendBlock->nextFragmentId = 0;
+                sendBlock->firstUnackedFragmentId = 0;
             }
-        }
 
-        if ( fragmentId == 0xFFFF )
-            return NULL;
+            assert( sendBlock->blockMessageId == messageId );
 
-        // allocate and return a copy of the fragment data
+            const int windowEnd = m_config.blockFragmentWindow > 0 ? min( sendBlock->firstUnackedFragmentId + m_config.blockFragmentWindow, sendBlock->numFragments ) : sendBlock->numFragments;
 
-        messageType = blockMessage->GetType();
+            // fragments are first sent in order, so the ones sent so far are [0,numSentFragments). unacked ones among them are resent round robin
+            // starting from the block's cursor, so send times only increase going around from it and the first fragment that isn't due ends the search.
+            // fragments are only added while they fit, since other channels may already have used part of the packet.
 
-        fragmentBytes = m_config.fragmentSize;
-        
-        const int fragmentRemainder = blockSize % m_config.fragmentSize;
+            const int firstFragmentId = next_unacked_fragment( *sendBlock, sendBlock->nextFragmentId, sendBlock->numSentFragments );
+
+            int fragmentId = firstFragmentId;
 
-        if ( fragmentRemainder && fragmentId == m_sendBlock->numFragments - 1 )
-            fragmentBytes = fragmentRemainder;
+            while ( fragmentId >= 0 )
+            {
+                if ( sendBlock->fragmentSendTime[fragmentId] + m_fragmentResendTime >= m_time )
+                    break;
 
-        uint8_t * fragmentData = (uint8_t*) m_messageFactory->GetAllocator().Allocate( fragmentBytes );
+                if ( !AddFragmentToSend( messageId, fragmentId, *sendBlock, fragments, numFragments, usedBits, availableBits ) )
+                    return;
 
-        if ( fragmentData )
-        {
-            memcpy( fragmentData, blockMessage->GetBlockData() + fragmentId * m_config.fragmentSize, fragmentBytes );
+                fragmentId = next_unacked_fragment( *sendBlock, fragmentId + 1, sendBlock->numSentFragments );
 
-            m_sendBlock->fragmentSendTime[fragmentId] = m_time;
+                if ( fragmentId == firstFragmentId )
+                    break;
+            }
+
+            // then fragments not sent yet, up to the end of the fragment window
+
+            for ( fragmentId = sendBlock->numSentFragments; fragmentId < windowEnd; ++fragmentId )
+            {
+                if ( !AddFragmentToSend( messageId, fragmentId, *sendBlock, fragments, numFragments, usedBits, availableBits ) )
+                    return;
+            }
         }
+    }
+
+    bool ReliableOrderedChannel::AddFragmentToSend( uint16_t messageId, int fragmentId, const SendBlockData & sendBlock, MessageSentFragmentEntry * fragments, int & numFragments, int & usedBits, int availableBits )
+    {
+        // returns false once the packet is full
+
+        const int fragmentBits = GetFragmentBits( messageId, fragmentId, GetFragmentBytes( sendBlock, fragmentId ) );
+
+        if ( usedBits + fragmentBits > availableBits )
+            return false;
+
+        fragments[numFragments].messageId = messageId;
+        fragments[numFragments].fragmentId = uint32_t( fragmentId );
 
-        return fragmentData;
+        numFragments++;
+
+        usedBits += fragmentBits;
+
+        return numFragments < m_config.maxFragmentsPerPacket;
     }
 
-    int ReliableOrderedChannel::GetFragmentPacketData( ChannelPacketData & packetData, uint16_t messageId, uint16_t fragmentId, uint8_t * fragmentData, int fragmentSize, int numFragments, int messageType )
+    int ReliableOrderedChannel::GetFragmentPacketData( ChannelPacketData & packetData, MessageSentFragmentEntry * fragments, int & numFragments )
     {
+        assert( numFragments > 0 );
+
+        Allocator & allocator = m_messageFactory->GetAllocator();
+
         packetData.channelId = GetChannelId();
 
         packetData.blockMessage = 1;
 
-        packetData.block.fragmentData = fragmentData;
-        packetData.block.messageId = messageId;
-        packetData.block.fragmentId = fragmentId;
-        packetData.block.fragmentSize = fragmentSize;
-        packetData.block.numFragments = numFragments;
-        packetData.block.messageType = messageType;
+        packetData.block.numPacketFragments = 0;
 
-        const int messageTypeBits = bits_required( 0, m_messageFactory->GetNumTypes() - 1 );
+        packetData.block.fragments = (ChannelPacketData::BlockFragmentData*) allocator.Allocate( sizeof( ChannelPacketData::BlockFragmentData ) * numFragments );
+
+        if ( !packetData.block.fragments )
+        {
+            numFragments = 0;
+            return 0;
+        }
 
-        int fragmentBits = ConservativeFragmentHeaderEstimate + fragmentSize;
+        int fragmentBits = 0;
 
-        if ( fragmentId == 0 )
+        for ( int i = 0; i < numFragments; ++i )
         {
-            MessageSendQueueEntry * entry = m_messageSendQueue->Find( packetData.block.messageId );
+            const uint16_t messageId = fragments[i].messageId;
+            const int fragmentId = fragments[i].fragmentId;
+
+            MessageSendQueueEntry * entry = m_messageSendQueue->Find( messageId );
 
             assert( entry );
             assert( entry->message );
 
-            packetData.block.message = (BlockMessage*) entry->message;
+            BlockMessage * blockMessage = (BlockMessage*) entry->message;
 
-            m_messageFactory->AddRef( packetData.block.message );
+            SendBlockData * sendBlock = GetSendBlock( messageId );
 
-            fragmentBits += entry->measuredBits + messageTypeBits;
-        }
-        else
-        {
-            packetData.block.message = NULL;
+            const int fragmentBytes = GetFragmentBytes( *sendBlock, fragmentId );
+
+            // IMPORTANT: fragment data points into the block message instead of being copied. the reference held by the fragment keeps it valid until the packet is freed, even if the block is acked first.
+
+            ChannelPacketData::BlockFragmentData & fragment = packetData.block.fragments[i];
+
+            fragment.message = blockMessage;
+            fragment.fragmentData = blockMessage->GetBlockData() + fragmentId * m_config.fragmentSize;
+            fragment.ownsFragmentData = false;
+            fragment.messageId = messageId;
+            fragment.fragmentId = fragmentId;
+            fragment.fragmentSize = fragmentBytes;
+            fragment.numFragments = sendBlock->numFragments;
+            fragment.messageType = blockMessage->GetType();
+
+            m_messageFactory->AddRef( fragment.message );
+
+            // first sends go out in order and leave the resend cursor alone, so send times still increase going around from it
+
+            if ( sendBlock->fragmentSendTime[fragmentId] < 0.0 )
+            {
+                assert( fragmentId == sendBlock->numSentFragments );
+                sendBlock->numSentFragments++;
+            }
+            else
+            {
+                sendBlock->nextFragmentId = fragmentId + 1;
+            }
+
+            sendBlock->fragmentSendTime[fragmentId] = m_time;
+
+            fragmentBits += GetFragmentBits( messageId, fragmentId, fragmentBytes );
+
+            packetData.block.numPacketFragments++;
         }
 
+        assert( packetData.block.numPacketFragments == numFragments );
+
         return fragmentBits;
     }
 
-    void ReliableOrderedChannel::AddFragmentPacketEntry( uint16_t messageId, uint16_t fragmentId, uint16_t sequence )
+    void ReliableOrderedChannel::AddFragmentPacketEntry( const MessageSentFragmentEntry * fragments, int numFragments, uint16_t sequence )
     {
         MessageSentPacketEntry * sentPacket = m_messageSentPackets->Insert( sequence );
         
@@ -975,104 +1376,153 @@ namespace yojimbo
             sentPacket->timeSent = m_time;
             sentPacket->acked = 0;
             sentPacket->block = 1;
-            sentPacket->blockMessageId = messageId;
-            sentPacket->blockFragmentId = fragmentId;
+            sentPacket->fragments = &m_sentPacketFragments[ ( sequence % m_config.sentPacketBufferSize ) * m_config.maxFragmentsPerPacket ];
+            sentPacket->numFragments = numFragments;
+            for ( int i = 0; i < numFragments; ++i )
+            {
+                sentPacket->fragments[i] = fragments[i];
+            }
         }
     }
 
-    void ReliableOrderedChannel::ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, uint16_t fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage )
+    void ReliableOrderedChannel::ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, int fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage )
     {  
         assert( !m_config.disableBlocks );
 
         if ( fragmentData )
         {
-            const uint16_t expectedMessageId = m_messageReceiveQueue->GetSequence();
+            // ignore fragments of blocks that were already received, or that are outside the receive window
+
+            if ( sequence_less_than( messageId, m_receiveMessageId ) )
+                return;
 
-            if ( messageId != expectedMessageId )
+            if ( uint16_t( messageId - m_receiveMessageId ) >= m_config.receiveQueueSize )
+                return;
+
+            if ( m_messageReceiveQueue->Find( messageId ) )
+                return;
+
+            ReceiveBlockData * receiveBlock = GetReceiveBlock( messageId );
+
+            // the slot may still be busy with an earlier block. drop the fragment, the sender resends it later
+
+            if ( receiveBlock->active && receiveBlock->messageId != messageId )
                 return;
 
             // start receiving a new block
 
-            if ( !m_receiveBlock->active )
+            if ( !receiveBlock->active )
             {
                 assert( numFragments >= 0 );
                 assert( numFragments <= m_config.GetMaxFragmentsPerBlock() );
 
-                m_receiveBlock->active = true;
-                m_receiveBlock->numFragments = numFragments;
-                m_receiveBlock->numReceivedFragments = 0;
-                m_receiveBlock->messageId = messageId;
-                m_receiveBlock->blockSize = 0;
-                m_receiveBlock->receivedFragment->Clear();
+                // IMPORTANT: block data is allocated only while the block is being received, and ownership passes to the block message once complete.
+                // streamed blocks with a fragment window only need room for the window, since fragments are passed on as soon as the gap before them fills.
+
+                assert( !receiveBlock->blockData );
+
+                const int numBufferFragments = ( m_config.streamBlocks && m_config.blockFragmentWindow > 0 ) ? min( numFragments, m_config.blockFragmentWindow ) : numFragments;
+
+                if ( !receiveBlock->AllocateFragments( numFragments ) )
+                {
+                    SetError( CHANNEL_ERROR_OUT_OF_MEMORY );
+                    return;
+                }
+
+                receiveBlock->blockData = (uint8_t*) m_messageFactory->GetAllocator().Allocate( numBufferFragments * m_config.fragmentSize );
+
+                if ( !receiveBlock->blockData )
+                {
+                    receiveBlock->FreeFragments();
+                    SetError( CHANNEL_ERROR_OUT_OF_MEMORY );
+                    return;
+                }
+
+                receiveBlock->active = true;
+                receiveBlock->numFragments = numFragments;
+                receiveBlock->numReceivedFragments = 0;
+                receiveBlock->numStreamedFragments = 0;
+                receiveBlock->numBufferFragments = numBufferFragments;
+                receiveBlock->messageId = messageId;
+                receiveBlock->blockSize = 0;
             }
 
             // validate fragment
 
-            if ( fragmentId >= m_receiveBlock->numFragments )
+            if ( fragmentId >= receiveBlock->numFragments )
             {
                 SetError( CHANNEL_ERROR_DESYNC );
                 return;
             }
 
-            if ( numFragments != m_receiveBlock->numFragments )
+            if ( numFragments != receiveBlock->numFragments )
             {
                 SetError( CHANNEL_ERROR_DESYNC );
                 return;
             }
 
+            // the sender never sends past the fragment window, so anything past the buffer would overwrite a fragment not yet passed on
+
+            if ( fragmentId >= receiveBlock->numStreamedFragments + receiveBlock->numBufferFragments )
+                return;
+
             // receive the fragment
 
-            if ( !m_receiveBlock->receivedFragment->GetBit( fragmentId ) )
+            if ( !receiveBlock->receivedFragment->GetBit( fragmentId ) )
             {
                 if ( m_listener )
                     m_listener->OnChannelFragmentReceived( this, messageId, fragmentId, fragmentBytes );
 
-                m_receiveBlock->receivedFragment->SetBit( fragmentId );
+                receiveBlock->receivedFragment->SetBit( fragmentId );
 
-                memcpy( m_receiveBlock->blockData + fragmentId * m_config.fragmentSize, fragmentData, fragmentBytes );
+                memcpy( receiveBlock->blockData + ( fragmentId % receiveBlock->numBufferFragments ) * m_config.fragmentSize, fragmentData, fragmentBytes );
 
                 if ( fragmentId == 0 )
                 {
-                    m_receiveBlock->messageType = messageType;
+                    receiveBlock->messageType = messageType;
                 }
 
-                if ( fragmentId == m_receiveBlock->numFragments - 1 )
+                if ( fragmentId == receiveBlock->numFragments - 1 )
                 {
-                    m_receiveBlock->blockSize = ( m_receiveBlock->numFragments - 1 ) * m_config.fragmentSize + fragmentBytes;
+                    receiveBlock->blockSize = ( receiveBlock->numFragments - 1 ) * m_config.fragmentSize + fragmentBytes;
 
-                    assert( m_receiveBlock->blockSize <= (uint32_t) m_config.maxBlockSize );
+                    assert( receiveBlock->blockSize <= (uint32_t) m_config.maxBlockSize );
                 }
 
-                m_receiveBlock->numReceivedFragments++;
+                receiveBlock->numReceivedFragments++;
 
                 if ( fragmentId == 0 )
                 {
                     // save block message (sent with fragment 0)
 
-                    m_receiveBlock->blockMessage = blockMessage;
+                    receiveBlock->blockMessage = blockMessage;
 
-                    m_messageFactory->AddRef( m_receiveBlock->blockMessage );
+                    m_messageFactory->AddRef( receiveBlock->blockMessage );
                 }
 
-                if ( m_receiveBlock->numReceivedFragments == m_receiveBlock->numFragments )
+                if ( m_config.streamBlocks )
+                    StreamBlockData( *receiveBlock );
+
+                if ( receiveBlock->numReceivedFragments == receiveBlock->numFragments )
                 {
                     // finished receiving block
 
-                    blockMessage = m_receiveBlock->blockMessage;
+                    blockMessage = receiveBlock->blockMessage;
 
                     assert( blockMessage );
 
-                    uint8_t * blockData = (uint8_t*) m_messageFactory->GetAllocator().Allocate( m_receiveBlock->blockSize );
+                    if ( m_config.streamBlocks )
+                    {
+                        // streamed block data has already been passed to the listener, so the block message is received without it
 
-                    if ( !blockData )
+                        m_messageFactory->GetAllocator().Free( receiveBlock->blockData );
+                    }
+                    else
                     {
-                        SetError( CHANNEL_ERROR_OUT_OF_MEMORY );
-                        return;
+                        blockMessage->AttachBlock( m_messageFactory->GetAllocator(), receiveBlock->blockData, receiveBlock->blockSize );
                     }
 
-                    memcpy( blockData, m_receiveBlock->blockData, m_receiveBlock->blockSize );
-
-                    blockMessage->AttachBlock( m_messageFactory->GetAllocator(), blockData, m_receiveBlock->blockSize );
+                    receiveBlock->blockData = NULL;
 
                     blockMessage->AssignId( messageId );
 
@@ -1086,8 +1536,9 @@ namespace yojimbo
                         return;
                     }
 
-                    m_receiveBlock->active = false;
-                    m_receiveBlock->blockMessage = NULL;
+                    receiveBlock->active = false;
+                    receiveBlock->blockMessage = NULL;
+                    receiveBlock->FreeFragments();
 
                     entry->message = blockMessage;
                 }
@@ -1095,6 +1546,49 @@ namespace yojimbo
         }
     }
 
+    void ReliableOrderedChannel::StreamBlockData( ReceiveBlockData & receiveBlock )
+    {
+        // pass on the contiguous run of received fragments following those already streamed. fragment 0 carries the block message, so it is always set by now.
+
+        const int start = receiveBlock.numStreamedFragments;
+
+        int end = receiveBlock.receivedFragment->FindFirstClear( start );
+
+        if ( end < 0 || end > receiveBlock.numFragments )
+            end = receiveBlock.numFragments;
+
+        if ( end == start )
+            return;
+
+        assert( receiveBlock.blockMessage );
+
+        receiveBlock.numStreamedFragments = end;
+
+        if ( !m_listener )
+            return;
+
+        // block data is a ring of fragments when the fragment window is smaller than the block, so the run may wrap around the end of the buffer
+
+        int fragmentId = start;
+
+        while ( fragmentId < end )
+        {
+            const int slot = fragmentId % receiveBlock.numBufferFragments;
+
+            const int runEnd = min( end, fragmentId + receiveBlock.numBufferFragments - slot );
+
+            const bool complete = runEnd == receiveBlock.numFragments;
+
+            const int offset = fragmentId * m_config.fragmentSize;
+
+            const int bytes = ( complete ? (int) receiveBlock.blockSize : runEnd * m_config.fragmentSize ) - offset;
+
+            m_listener->OnChannelBlockData( this, receiveBlock.messageId, receiveBlock.blockMessage, receiveBlock.blockData + slot * m_config.fragmentSize, offset, bytes, complete );
+
+            fragmentId = runEnd;
+        }
+    }
+
     uint64_t ReliableOrderedChannel::GetCounter( int index ) const
     {
         assert( index >= 0 );
@@ -1104,6 +1598,133 @@ namespace yojimbo
 
     // ------------------------------------------------
 
+    ReliableUnorderedChannel::ReliableUnorderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId ) 
+        : ReliableOrderedChannel( allocator, messageFactory, config, channelId )
+    {
+        m_messageArrivalQueue = YOJIMBO_NEW( *m_allocator, Queue<uint16_t>, *m_allocator, m_config.receiveQueueSize );
+    }
+
+    ReliableUnorderedChannel::~ReliableUnorderedChannel()
+    {
+        Reset();
+
+        YOJIMBO_DELETE( *m_allocator, Queue<uint16_t>, m_messageArrivalQueue );
+    }
+
+    void ReliableUnorderedChannel::Reset()
+    {
+        ReliableOrderedChannel::Reset();
+
+        m_messageArrivalQueue->Clear();
+    }
+
+    Message * ReliableUnorderedChannel::ReceiveMessage()
+    {
+        if ( GetError() != CHANNEL_ERROR_NONE )
+            return NULL;
+
+        if ( m_messageArrivalQueue->IsEmpty() )
+            return NULL;
+
+        const uint16_t messageId = m_messageArrivalQueue->Pop();
+
+        MessageReceiveQueueEntry * entry = m_messageReceiveQueue->Find( messageId );
+
+        assert( entry );
+        assert( entry->message );
+
+        Message * message = entry->message;
+
+        assert( message->GetId() == messageId );
+
+        // IMPORTANT: keep the entry after delivering the message, so a resent copy is recognized as a duplicate. 
+        // entries are only removed once every message before them has been delivered too, sliding the receive window forward.
+
+        entry->message = NULL;
+
+        while ( true )
+        {
+            MessageReceiveQueueEntry * oldestEntry = m_messageReceiveQueue->Find( m_receiveMessageId );
+
+            if ( !oldestEntry || oldestEntry->message )
+                break;
+
+            m_messageReceiveQueue->Remove( m_receiveMessageId );
+
+            m_receiveMessageId++;
+        }
+
+        m_counters[CHANNEL_COUNTER_MESSAGES_RECEIVED]++;
+
+        return message;
+    }
+
+    bool ReliableUnorderedChannel::IsNewMessage( uint16_t messageId ) const
+    {
+        return !sequence_less_than( messageId, m_receiveMessageId ) && !m_messageReceiveQueue->Find( messageId );
+    }
+
+    void ReliableUnorderedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        // the ordered channel does the receive window, duplicate suppression and block reassembly. 
+        // note which messages are new before handing the packet data over, and deliver those as soon as they land in the receive queue.
+
+        if ( packetData.blockMessage )
+        {
+            const int numPacketFragments = packetData.block.numPacketFragments;
+
+            bool * newMessage = (bool*) alloca( sizeof( bool ) * numPacketFragments );
+
+            for ( int i = 0; i < numPacketFragments; ++i )
+                newMessage[i] = IsNewMessage( packetData.block.fragments[i].messageId );
+
+            ReliableOrderedChannel::ProcessPacketData( packetData, packetSequence );
+
+            if ( GetError() != CHANNEL_ERROR_NONE )
+                return;
+
+            for ( int i = 0; i < numPacketFragments; ++i )
+            {
+                const uint16_t messageId = packetData.block.fragments[i].messageId;
+
+                if ( !newMessage[i] || !m_messageReceiveQueue->Find( messageId ) )
+                    continue;
+
+                // several fragments of the same block can complete it in one packet. only note its arrival once.
+
+                for ( int j = i + 1; j < numPacketFragments; ++j )
+                {
+                    if ( packetData.block.fragments[j].messageId == messageId )
+                        newMessage[j] = false;
+                }
+
+                m_messageArrivalQueue->Push( messageId );
+            }
+        }
+        else
+        {
+            const int numMessages = packetData.message.numMessages;
+
+            bool * newMessage = (bool*) alloca( sizeof( bool ) * numMessages );
+
+            for ( int i = 0; i < numMessages; ++i )
+                newMessage[i] = IsNewMessage( packetData.message.messages[i]->GetId() );
+
+            ReliableOrderedChannel::ProcessPacketData( packetData, packetSequence );
+
+            if ( GetError() != CHANNEL_ERROR_NONE )
+                return;
+
+            for ( int i = 0; i < numMessages; ++i )
+            {
+                const uint16_t messageId = packetData.message.messages[i]->GetId();
+
+                if ( newMessage[i] && m_messageReceiveQueue->Find( messageId ) )
+                    m_messageArrivalQueue->Push( messageId );
+            }
+        }
+    }
+
     UnreliableUnorderedChannel::UnreliableUnorderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId ) 
         : m_config( config )
     {
@@ -1315,4 +1936,79 @@ namespace yojimbo
         assert( index < CHANNEL_COUNTER_NUM_COUNTERS );
         return m_counters[index];
     }
+
+    UnreliableSequencedChannel::UnreliableSequencedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId ) 
+        : UnreliableUnorderedChannel( allocator, messageFactory, config, channelId )
+    {
+        m_sendSequence = 0;
+        m_receivedPacketData = false;
+        m_receiveSequence = 0;
+    }
+
+    void UnreliableSequencedChannel::Reset()
+    {
+        UnreliableUnorderedChannel::Reset();
+
+        m_sendSequence = 0;
+        m_receivedPacketData = false;
+        m_receiveSequence = 0;
+    }
+
+    void UnreliableSequencedChannel::SendMessage( Message * message )
+    {
+        assert( message );
+
+        if ( m_config.latestOnly && GetError() == CHANNEL_ERROR_NONE )
+        {
+            for ( int i = 0; i < m_messageSendQueue->GetNumEntries(); ++i )
+            {
+                Message * & queuedMessage = (*m_messageSendQueue)[i];
+
+                if ( queuedMessage->GetType() == message->GetType() )
+                {
+                    m_messageFactory->Release( queuedMessage );
+
+                    queuedMessage = message;
+
+                    m_counters[CHANNEL_COUNTER_MESSAGES_SENT]++;
+
+                    return;
+                }
+            }
+        }
+
+        UnreliableUnorderedChannel::SendMessage( message );
+    }
+
+    int UnreliableSequencedChannel::GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits )
+    {
+        const int sequenceBits = 16;
+
+        if ( m_config.packetBudget > 0 )
+            availableBits = min( m_config.packetBudget * 8, availableBits );
+
+        const int packetDataBits = UnreliableUnorderedChannel::GetPacketData( packetData, packetSequence, availableBits - sequenceBits );
+
+        if ( packetDataBits == 0 )
+            return 0;
+
+        packetData.message.sequence = m_sendSequence++;
+
+        return packetDataBits + sequenceBits;
+    }
+
+    void UnreliableSequencedChannel::ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence )
+    {
+        // messages are sequenced by the channel sequence of the packet data that carried them. the packet sequence
+        // can't be used for this, because it keeps advancing while the channel is idle and would wrap around.
+        // messages not newer than the newest already received (reordered or duplicated) are stale, so drop them.
+
+        if ( m_receivedPacketData && !sequence_greater_than( packetData.message.sequence, m_receiveSequence ) )
+            return;
+
+        m_receivedPacketData = true;
+        m_receiveSequence = packetData.message.sequence;
+
+        UnreliableUnorderedChannel::ProcessPacketData( packetData, packetSequence );
+    }
 }
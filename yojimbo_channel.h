@@ -41,7 +41,9 @@ namespace yojimbo
     enum ChannelType
     {
         CHANNEL_TYPE_RELIABLE_ORDERED,                          // reliable ordered stream of messages
-        CHANNEL_TYPE_UNRELIABLE_UNORDERED                       // unreliable unordered stream of messages
+        CHANNEL_TYPE_UNRELIABLE_UNORDERED,                      // unreliable unordered stream of messages
+        CHANNEL_TYPE_UNRELIABLE_SEQUENCED,                      // unreliable stream of messages. messages older than the newest received are discarded.
+        CHANNEL_TYPE_RELIABLE_UNORDERED                         // reliable stream of messages, delivered as soon as they arrive
     };
 
     struct ChannelConfig
@@ -55,8 +57,19 @@ namespace yojimbo
         int maxBlockSize;                                       // maximum block size in bytes
         int fragmentSize;                                       // block fragments size in bytes
         float fragmentResendTime;                               // fragment resend time (seconds)
+        int maxFragmentsPerPacket;                              // maximum number of block fragments per-packet. fragments after the first are only added while they fit in the available bits.
+        int maxBlocksInFlight;                                  // maximum number of consecutive block messages being sent at once. the next block starts once every fragment of the previous one has been sent.
+        bool adaptiveResendTime;                                // if true, messages and fragments are resent after RTO = SRTT + 4*RTTVAR measured by the connection, instead of the fixed resend times above.
+        float minResendTime;                                    // lower bound on the adaptive resend time (seconds)
+        float maxResendTime;                                    // upper bound on the adaptive resend time (seconds)
         int sentPacketBufferSize;                               // size of sent packets buffer in # of packets stored (maps packet level acks to messages & fragments)
-        bool disableBlocks;                                     // disable blocks for this channel. saves maxBlockSize * 2 in memory.
+        bool disableBlocks;                                     // disable blocks for this channel. block receive buffers are only allocated while a block is being received, so this mostly saves per-fragment bookkeeping.
+        float priority;                                         // relative weight of this channel when sharing packet bandwidth with other channels. must be > 0.
+        bool latencySensitive;                                  // if true, this channel gets first pick of each packet ahead of the weighted channels.
+        bool latestOnly;                                        // unreliable sequenced channels only. if true, sending a message replaces any queued but unsent message of the same type.
+        bool cacheMessageBits;                                  // reliable channels only. if true, messages are serialized once when sent and their bits are copied into each packet, including resends. messages are captured with the context passed to Connection::SetContext. until one is set they are sent uncached.
+        bool streamBlocks;                                      // reliable channels only. if true, received block data is passed to the channel listener in order as contiguous ranges arrive, and block messages are received without a block attached.
+        int blockFragmentWindow;                                // maximum number of fragments past the first unacked fragment of a block that may be sent. 0 means no limit. streamed blocks only buffer this many fragments on receive.
 
         ChannelConfig() : type ( CHANNEL_TYPE_RELIABLE_ORDERED )
         {
@@ -68,13 +81,24 @@ namespace yojimbo
             maxBlockSize = 256 * 1024;
             fragmentSize = 1024;
             fragmentResendTime = 0.25f;
+            maxFragmentsPerPacket = 8;
+            maxBlocksInFlight = 1;
+            adaptiveResendTime = false;
+            minResendTime = 0.02f;
+            maxResendTime = 1.0f;
             sentPacketBufferSize = 1024;
             disableBlocks = false;
+            priority = 1.0f;
+            latencySensitive = false;
+            latestOnly = false;
+            cacheMessageBits = false;
+            streamBlocks = false;
+            blockFragmentWindow = 0;
         }
 
         int GetMaxFragmentsPerBlock() const
         {
-            return maxBlockSize / fragmentSize;
+            return ( maxBlockSize + fragmentSize - 1 ) / fragmentSize;
         }
     };
 
@@ -87,23 +111,32 @@ namespace yojimbo
         {
             int numMessages;
             Message ** messages;
+            uint16_t * messageIds;                                      // ids to write for each message. NULL if the ids come from the messages themselves.
+            uint16_t sequence;                                          // channel sequence of this packet data. only serialized for unreliable sequenced channels.
         };
 
-        struct BlockData
+        struct BlockFragmentData
         {
-            BlockMessage * message;
-            uint8_t * fragmentData;
-            uint64_t messageId : 16;
-            uint64_t fragmentId : 16;
-            uint64_t fragmentSize : 16;
-            uint64_t numFragments : 16;
+            BlockMessage * message;                                     // block message. serialized with fragment 0. on send, every fragment holds a reference so fragment data stays valid.
+            uint8_t * fragmentData;                                     // on send, points into the block message data. on receive, allocated for this packet.
+            bool ownsFragmentData;                                      // true if fragment data is freed with the packet.
+            uint16_t messageId;
+            uint32_t fragmentId;
+            uint32_t fragmentSize;
+            uint32_t numFragments;
             int messageType;
         };
 
+        struct BlockData
+        {
+            int numPacketFragments;                                     // number of fragments in this packet. they may belong to different blocks.
+            BlockFragmentData * fragments;
+        };
+
         union
         {
             MessageData message;                                        // packet data for sending messages
-            BlockData block;                                            // packet data for sending a block
+            BlockData block;                                            // packet data for sending block fragments
         };
 
         ChannelPacketData()
@@ -111,6 +144,8 @@ namespace yojimbo
             channelId = 0;
             blockMessage = 0;
             message.numMessages = 0;
+            message.messageIds = NULL;
+            message.sequence = 0;
         }
 
         void Free( MessageFactory & messageFactory );
@@ -130,7 +165,9 @@ namespace yojimbo
 
         virtual ~ChannelListener() {}
 
-        virtual void OnChannelFragmentReceived( class Channel * /*channel*/, uint16_t /*messageId*/, uint16_t /*fragmentId*/, int /*fragmentBytes*/ ) {}
+        virtual void OnChannelFragmentReceived( class Channel * /*channel*/, uint16_t /*messageId*/, int /*fragmentId*/, int /*fragmentBytes*/ ) {}
+
+        virtual void OnChannelBlockData( class Channel * /*channel*/, uint16_t /*messageId*/, BlockMessage * /*blockMessage*/, const uint8_t * /*data*/, int /*offset*/, int /*bytes*/, bool /*complete*/ ) {}
     };
 
     enum ChannelCounters
@@ -175,6 +212,10 @@ namespace yojimbo
 
         virtual void ProcessAck( uint16_t sequence ) = 0;
 
+        virtual void UpdateRTT( double /*rtt*/, double /*rttVariance*/ ) {}
+
+        virtual void SetContext( void * /*context*/ ) {}
+
         ChannelError GetError() const { return m_error; }
 
         int GetChannelId() const { return m_channelId; }
@@ -234,17 +275,37 @@ namespace yojimbo
 
         void ProcessAck( uint16_t ack );
 
+        void UpdateRTT( double rtt, double rttVariance );
+
+        double GetMessageResendTime() const { return m_messageResendTime; }
+
+        double GetFragmentResendTime() const { return m_fragmentResendTime; }
+
         void UpdateOldestUnackedMessageId();
 
+        void CompactMessageResendQueue();
+
         bool SendingBlockMessage();
 
-        uint8_t * GetFragmentToSend( uint16_t & messageId, uint16_t & fragmentId, int & fragmentBytes, int & numFragments, int & messageType );
+        SendBlockData * GetSendBlock( uint16_t messageId );
+
+        ReceiveBlockData * GetReceiveBlock( uint16_t messageId );
+
+        int GetFragmentBytes( const SendBlockData & sendBlock, int fragmentId ) const;
+
+        int GetFragmentBits( uint16_t messageId, int fragmentId, int fragmentBytes );
 
-        int GetFragmentPacketData( ChannelPacketData & packetData, uint16_t messageId, uint16_t fragmentId, uint8_t * fragmentData, int fragmentSize, int numFragments, int messageType );
+        void GetFragmentsToSend( MessageSentFragmentEntry * fragments, int & numFragments, int availableBits );
 
-        void AddFragmentPacketEntry( uint16_t messageId, uint16_t fragmentId, uint16_t sequence );
+        bool AddFragmentToSend( uint16_t messageId, int fragmentId, const SendBlockData & sendBlock, MessageSentFragmentEntry * fragments, int & numFragments, int & usedBits, int availableBits );
 
-        void ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, uint16_t fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage );
+        int GetFragmentPacketData( ChannelPacketData & packetData, MessageSentFragmentEntry * fragments, int & numFragments );
+
+        void AddFragmentPacketEntry( const MessageSentFragmentEntry * fragments, int numFragments, uint16_t sequence );
+
+        void ProcessPacketFragment( int messageType, uint16_t messageId, int numFragments, int fragmentId, const uint8_t * fragmentData, int fragmentBytes, BlockMessage * blockMessage );
+
+        void StreamBlockData( ReceiveBlockData & receiveBlock );
 
         Message * GetSendQueueMessage( uint16_t messageId );
 
@@ -252,7 +313,9 @@ namespace yojimbo
 
         void SetListener( ChannelListener * listener ) { m_listener = listener; }
 
-    private:
+        void SetContext( void * context ) { m_context = context; }
+
+    protected:
 
         const ChannelConfig m_config;                                                   // const configuration data
 
@@ -260,10 +323,16 @@ namespace yojimbo
 
         ChannelListener * m_listener;                                                   // channel listener for callbacks. optional.
 
+        void * m_context;                                                               // serialization context used to capture cached message bits. NULL if not set.
+
         MessageFactory * m_messageFactory;                                              // message factory creates and destroys messages
 
         double m_time;                                                                  // current time
 
+        double m_messageResendTime;                                                     // time before an unacked message is resent. adapted to rtt if config.adaptiveResendTime is true.
+
+        double m_fragmentResendTime;                                                    // time before an unacked block fragment is resent. adapted to rtt if config.adaptiveResendTime is true.
+
         uint16_t m_sendMessageId;                                                       // id for next message added to send queue
 
         uint16_t m_receiveMessageId;                                                    // id for next message to be received
@@ -272,15 +341,21 @@ namespace yojimbo
 
         SequenceBuffer<MessageSendQueueEntry> * m_messageSendQueue;                     // message send queue
 
+        Queue<MessageResendEntry> * m_messageResendQueue;                               // sent messages in the order they were last sent, so the front is the first due for resend. stale entries are discarded lazily, or compacted when it fills.
+
+        uint16_t m_unsentMessageId;                                                     // id of the oldest message in the send queue that has never been sent
+
         SequenceBuffer<MessageSentPacketEntry> * m_messageSentPackets;                  // messages in sent packets (for acks)
 
         SequenceBuffer<MessageReceiveQueueEntry> * m_messageReceiveQueue;               // message receive queue
 
         uint16_t * m_sentPacketMessageIds;                                              // array of message ids, n ids per-sent packet
 
-        SendBlockData * m_sendBlock;                                                    // block being sent
+        MessageSentFragmentEntry * m_sentPacketFragments;                               // array of block fragments, n per-sent packet
 
-        ReceiveBlockData * m_receiveBlock;                                              // block being received
+        SendBlockData ** m_sendBlocks;                                                  // blocks being sent, indexed by message id modulo config.maxBlocksInFlight
+
+        ReceiveBlockData ** m_receiveBlocks;                                            // blocks being received, indexed by message id modulo config.maxBlocksInFlight
 
         uint64_t m_counters[CHANNEL_COUNTER_NUM_COUNTERS];                              // counters for unit testing, stats etc.
 
@@ -291,6 +366,35 @@ namespace yojimbo
         ReliableOrderedChannel & operator = ( const ReliableOrderedChannel & other );
     };
 
+    class ReliableUnorderedChannel : public ReliableOrderedChannel
+    {
+    public:
+
+        ReliableUnorderedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId );
+
+        ~ReliableUnorderedChannel();
+
+        void Reset();
+
+        Message * ReceiveMessage();
+
+        void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
+
+    protected:
+
+        bool IsNewMessage( uint16_t messageId ) const;
+
+    private:
+
+        Queue<uint16_t> * m_messageArrivalQueue;                                        // ids of messages received but not yet delivered, in the order they arrived
+
+    private:
+
+        ReliableUnorderedChannel( const ReliableUnorderedChannel & other );
+
+        ReliableUnorderedChannel & operator = ( const ReliableUnorderedChannel & other );
+    };
+
     class UnreliableUnorderedChannel : public Channel
     {
     public:
@@ -319,7 +423,7 @@ namespace yojimbo
 
         void SetListener( ChannelListener * listener ) { m_listener = listener; }
 
-    private:
+    protected:
 
         const ChannelConfig m_config;                                                   // const configuration data
 
@@ -341,6 +445,35 @@ namespace yojimbo
 
         UnreliableUnorderedChannel & operator = ( const UnreliableUnorderedChannel & other );
     };
+
+    class UnreliableSequencedChannel : public UnreliableUnorderedChannel
+    {
+    public:
+
+        UnreliableSequencedChannel( Allocator & allocator, MessageFactory & messageFactory, const ChannelConfig & config, int channelId );
+
+        void Reset();
+
+        void SendMessage( Message * message );
+
+        int GetPacketData( ChannelPacketData & packetData, uint16_t packetSequence, int availableBits );
+
+        void ProcessPacketData( const ChannelPacketData & packetData, uint16_t packetSequence );
+
+    private:
+
+        uint16_t m_sendSequence;                                                        // channel sequence of the next packet data sent. only advances when this channel sends.
+
+        bool m_receivedPacketData;                                                      // true once packet data has been received. until then any channel sequence is newer.
+
+        uint16_t m_receiveSequence;                                                     // channel sequence of the newest packet data received. anything not newer is stale.
+
+    private:
+
+        UnreliableSequencedChannel( const UnreliableSequencedChannel & other );
+
+        UnreliableSequencedChannel & operator = ( const UnreliableSequencedChannel & other );
+    };
 }
 
 #endif
@@ -46,6 +46,9 @@ namespace yojimbo
             
         if ( expiryTimestamp != other.expiryTimestamp )
             return false;
+
+        if ( serverId != other.serverId )
+            return false;
             
         if ( numServerAddresses != other.numServerAddresses )
             return false;
@@ -73,13 +76,14 @@ namespace yojimbo
         return ! ( (*this) == other );
     }
 
-    void GenerateConnectToken( ConnectToken & token, uint64_t clientId, int numServerAddresses, const Address * serverAddresses, uint32_t protocolId )
+    void GenerateConnectToken( ConnectToken & token, uint64_t clientId, int numServerAddresses, const Address * serverAddresses, uint32_t protocolId, uint64_t serverId )
     {
         uint64_t timestamp = (uint64_t) time( NULL );
         
         token.protocolId = protocolId;
         token.clientId = clientId;
         token.expiryTimestamp = timestamp + ConnectTokenExpirySeconds;
+        token.serverId = serverId;
         
         assert( numServerAddresses > 0 );
         assert( numServerAddresses <= MaxServersPerConnectToken );
@@ -126,6 +130,22 @@ namespace yojimbo
         return ReadConnectTokenFromJSON( (const char*) decryptedMessage, decryptedToken );
     }
 
+    void GenerateConnectTokenAdditionalData( uint32_t protocolId, uint64_t expiryTimestamp, uint64_t serverId, uint8_t * additionalData )
+    {
+        assert( additionalData );
+
+        // IMPORTANT: little endian so the matcher and server agree on the bytes regardless of platform.
+
+        for ( int i = 0; i < 4; ++i )
+            additionalData[i] = (uint8_t) ( protocolId >> ( i * 8 ) );
+
+        for ( int i = 0; i < 8; ++i )
+            additionalData[4+i] = (uint8_t) ( expiryTimestamp >> ( i * 8 ) );
+
+        for ( int i = 0; i < 8; ++i )
+            additionalData[12+i] = (uint8_t) ( serverId >> ( i * 8 ) );
+    }
+
     static void insert_number_as_string( Writer<StringBuffer> & writer, const char * key, uint64_t number )
     {
         char buffer[256];
@@ -153,6 +173,8 @@ namespace yojimbo
 
         insert_number_as_string( writer, "expiryTimestamp", connectToken.expiryTimestamp );
 
+        insert_number_as_string( writer, "serverId", connectToken.serverId );
+
         insert_number_as_string( writer, "numServerAddresses", connectToken.numServerAddresses );
 
         writer.Key( "serverAddresses" );
@@ -193,7 +215,15 @@ namespace yojimbo
         return true;
     }
 
-    static bool read_int_from_string( Document & doc, const char * key, int & value )
+    // connect tokens are parsed while processing connection requests, so parse them out of fixed size stack buffers instead of the heap
+
+    typedef GenericDocument< UTF8<>, MemoryPoolAllocator<>, MemoryPoolAllocator<> > TokenDocument;
+
+    const int ConnectTokenValueBufferBytes = 4096;
+    const int ConnectTokenParseBufferBytes = 2048;
+    const int ConnectTokenParseStackBytes = 1024;
+
+    static bool read_int_from_string( TokenDocument & doc, const char * key, int & value )
     {
         if ( !doc.HasMember( key ) )
             return false;
@@ -206,7 +236,7 @@ namespace yojimbo
         return true;
     }
 
-    static bool read_uint32_from_string( Document & doc, const char * key, uint32_t & value )
+    static bool read_uint32_from_string( TokenDocument & doc, const char * key, uint32_t & value )
     {
         if ( !doc.HasMember( key ) )
             return false;
@@ -219,7 +249,7 @@ namespace yojimbo
         return true;
     }
 
-    static bool read_uint64_from_string( Document & doc, const char * key, uint64_t & value )
+    static bool read_uint64_from_string( TokenDocument & doc, const char * key, uint64_t & value )
     {
         if ( !doc.HasMember( key ) )
             return false;
@@ -232,7 +262,7 @@ namespace yojimbo
         return true;
     }
 
-    static bool read_data_from_base64_string( Document & doc, const char * key, uint8_t * data, int data_bytes )
+    static bool read_data_from_base64_string( TokenDocument & doc, const char * key, uint8_t * data, int data_bytes )
     {
         if ( !doc.HasMember( key ) )
             return false;
@@ -253,7 +283,13 @@ namespace yojimbo
     {
         assert( json );
 
-        Document doc;
+        uint8_t valueBuffer[ConnectTokenValueBufferBytes];
+        uint8_t parseBuffer[ConnectTokenParseBufferBytes];
+
+        MemoryPoolAllocator<> valueAllocator( valueBuffer, sizeof( valueBuffer ) );
+        MemoryPoolAllocator<> parseAllocator( parseBuffer, sizeof( parseBuffer ) );
+
+        TokenDocument doc( &valueAllocator, ConnectTokenParseStackBytes, &parseAllocator );
         doc.Parse( json );
         if ( doc.HasParseError() )
             return false;
@@ -267,6 +303,13 @@ namespace yojimbo
         if ( !read_uint64_from_string( doc, "expiryTimestamp", connectToken.expiryTimestamp ) )
             return false;
 
+        // tokens from matchers that predate server ids leave it out. those are for server id 0.
+
+        connectToken.serverId = 0;
+
+        if ( doc.HasMember( "serverId" ) && !read_uint64_from_string( doc, "serverId", connectToken.serverId ) )
+            return false;
+
         if ( !read_int_from_string( doc, "numServerAddresses", connectToken.numServerAddresses ) )
             return false;
 
@@ -382,6 +425,174 @@ namespace yojimbo
 
     // =============================================================
 
+    HandshakeRateLimiter::HandshakeRateLimiter()
+    {
+        Reset( 0, 0.0 );
+    }
+
+    void HandshakeRateLimiter::Reset( uint64_t seed, double time, int decryptBudget )
+    {
+        assert( decryptBudget > 0 );
+        m_seed = seed;
+        m_decayTime = time;
+        m_budgetTime = time;
+        m_decryptBudget = decryptBudget;
+        m_budget = decryptBudget;
+        memset( m_counters, 0, sizeof( m_counters ) );
+    }
+
+    bool HandshakeRateLimiter::Admit( const Address & address, double time )
+    {
+        Decay( time );
+
+        uint8_t key[19];
+        int keyBytes = 0;
+        int prefixBytes = 0;
+
+        if ( address.GetType() == ADDRESS_IPV4 )
+        {
+            const uint32_t ipv4 = address.GetAddress4();
+            key[0] = ADDRESS_IPV4;
+            key[1] = (uint8_t) ( ipv4 );
+            key[2] = (uint8_t) ( ipv4 >> 8 );
+            key[3] = (uint8_t) ( ipv4 >> 16 );
+            key[4] = (uint8_t) ( ipv4 >> 24 );
+            keyBytes = 5;
+            prefixBytes = 4;
+        }
+        else if ( address.GetType() == ADDRESS_IPV6 )
+        {
+            const uint16_t * ipv6 = address.GetAddress6();
+            key[0] = ADDRESS_IPV6;
+            for ( int i = 0; i < 8; ++i )
+            {
+                key[1+i*2] = (uint8_t) ( ipv6[i] );
+                key[2+i*2] = (uint8_t) ( ipv6[i] >> 8 );
+            }
+            keyBytes = 17;
+            prefixBytes = 9;
+        }
+        else
+        {
+            return false;
+        }
+
+        const uint16_t port = address.GetPort();
+        key[keyBytes++] = (uint8_t) ( port );
+        key[keyBytes++] = (uint8_t) ( port >> 8 );
+
+        // the prefix key is a strict prefix of the address key, but is hashed with a different length so they never alias
+
+        int prefixIndex[HandshakeRateLimitDepth];
+        int addressIndex[HandshakeRateLimitDepth];
+
+        GetIndices( key, prefixBytes, prefixIndex );
+        GetIndices( key, keyBytes, addressIndex );
+
+        // check the prefix before the address, so a noisy network is turned away without touching its address counters
+
+        if ( Estimate( prefixIndex ) >= (uint32_t) HandshakeRateLimitPerPrefix )
+            return false;
+
+        if ( Estimate( addressIndex ) >= (uint32_t) HandshakeRateLimitPerAddress )
+            return false;
+
+        // IMPORTANT: only admitted packets are counted, and admissions are capped by the global budget. A spoofed spray adds at
+        // most the budget to the sketch each decay period, which is far too little to push every counter over the per-address
+        // limit. Past the budget we shed the excess, and a real client that keeps retrying gets its share of what's admitted.
+
+        if ( !SpendBudget( time ) )
+            return false;
+
+        Add( prefixIndex );
+        Add( addressIndex );
+
+        return true;
+    }
+
+    void HandshakeRateLimiter::Decay( double time )
+    {
+        if ( time < m_decayTime + HandshakeRateLimitDecayTime )
+            return;
+
+        const int numDecays = (int) ( ( time - m_decayTime ) / HandshakeRateLimitDecayTime );
+
+        m_decayTime += numDecays * HandshakeRateLimitDecayTime;
+
+        if ( numDecays >= 16 )
+        {
+            memset( m_counters, 0, sizeof( m_counters ) );
+            return;
+        }
+
+        for ( int i = 0; i < HandshakeRateLimitDepth; ++i )
+        {
+            for ( int j = 0; j < HandshakeRateLimitWidth; ++j )
+                m_counters[i][j] >>= numDecays;
+        }
+    }
+
+    bool HandshakeRateLimiter::SpendBudget( double time )
+    {
+        if ( time > m_budgetTime )
+        {
+            m_budget += ( time - m_budgetTime ) * m_decryptBudget;
+            if ( m_budget > m_decryptBudget )
+                m_budget = m_decryptBudget;
+            m_budgetTime = time;
+        }
+
+        if ( m_budget < 1.0 )
+            return false;
+
+        m_budget -= 1.0;
+
+        return true;
+    }
+
+    void HandshakeRateLimiter::GetIndices( const uint8_t * key, int keyBytes, int * index ) const
+    {
+        // derive one counter index per row from a single 64 bit hash (Kirsch-Mitzenmacher)
+
+        const uint64_t hash = murmur_hash_64( key, keyBytes, m_seed );
+        const uint32_t hash1 = (uint32_t) hash;
+        const uint32_t hash2 = (uint32_t) ( hash >> 32 ) | 1;
+
+        for ( int i = 0; i < HandshakeRateLimitDepth; ++i )
+            index[i] = ( hash1 + i * hash2 ) % HandshakeRateLimitWidth;
+    }
+
+    uint32_t HandshakeRateLimiter::Estimate( const int * index ) const
+    {
+        uint32_t estimate = 0xFFFF;
+
+        for ( int i = 0; i < HandshakeRateLimitDepth; ++i )
+        {
+            if ( m_counters[i][index[i]] < estimate )
+                estimate = m_counters[i][index[i]];
+        }
+
+        return estimate;
+    }
+
+    void HandshakeRateLimiter::Add( const int * index )
+    {
+        const uint32_t estimate = Estimate( index );
+
+        if ( estimate == 0xFFFF )
+            return;
+
+        // conservative update: only bump the counters that hold the minimum. keeps overestimates from colliding sources down.
+
+        for ( int i = 0; i < HandshakeRateLimitDepth; ++i )
+        {
+            if ( m_counters[i][index[i]] == estimate )
+                m_counters[i][index[i]]++;
+        }
+    }
+
+    // =============================================================
+
     const char * GetClientStateName( int clientState )
     {
         switch ( clientState )
@@ -425,6 +636,8 @@ namespace yojimbo
         m_lastPacketReceiveTime = 0.0;
         m_clientSalt = 0;
         m_sequence = 0;
+        m_connectTokenExpireTimestamp = 0;
+        m_connectTokenServerId = 0;
     }
 
     Client::Client( Allocator & allocator, Transport & transport )
@@ -490,7 +703,9 @@ namespace yojimbo
                           const uint8_t * connectTokenData, 
                           const uint8_t * connectTokenNonce,
                           const uint8_t * clientToServerKey,
-                          const uint8_t * serverToClientKey )
+                          const uint8_t * serverToClientKey,
+                          uint64_t connectTokenExpireTimestamp,
+                          uint64_t connectTokenServerId )
     {
         if ( !m_streamAllocator )
         {
@@ -503,6 +718,7 @@ namespace yojimbo
             m_messageFactory = CreateMessageFactory();
             m_connection = YOJIMBO_NEW( *m_allocator, Connection, *m_allocator, *m_transport->GetPacketFactory(), *m_messageFactory, m_connectionConfig );
             m_connection->SetListener( this );
+            m_connection->SetContext( &m_context );
         }
 
         InitializeContext();
@@ -523,6 +739,8 @@ namespace yojimbo
         m_lastPacketReceiveTime = time;
         memcpy( m_connectTokenData, connectTokenData, ConnectTokenBytes );
         memcpy( m_connectTokenNonce, connectTokenNonce, NonceBytes );
+        m_connectTokenExpireTimestamp = connectTokenExpireTimestamp;
+        m_connectTokenServerId = connectTokenServerId;
 
         m_transport->ResetEncryptionMappings();
 
@@ -659,6 +877,9 @@ namespace yojimbo
                 ConnectionRequestPacket * packet = (ConnectionRequestPacket*) m_transport->CreatePacket( CLIENT_SERVER_PACKET_CONNECTION_REQUEST );
                 if ( packet )
                 {
+                    packet->connectTokenProtocolId = m_transport->GetProtocolId();
+                    packet->connectTokenExpireTimestamp = m_connectTokenExpireTimestamp;
+                    packet->connectTokenServerId = m_connectTokenServerId;
                     memcpy( packet->connectTokenData, m_connectTokenData, ConnectTokenBytes );
                     memcpy( packet->connectTokenNonce, m_connectTokenNonce, NonceBytes );
 
@@ -833,6 +1054,16 @@ namespace yojimbo
         return m_clientIndex;
     }
 
+    bool Client::GetConnectionStats( ConnectionStats & stats ) const
+    {
+        if ( !m_connection || !IsConnected() )
+            return false;
+
+        m_connection->GetStats( stats );
+
+        return true;
+    }
+
     void Client::InitializeContext()
     {
         m_context.messageFactory = m_messageFactory;
@@ -880,6 +1111,8 @@ namespace yojimbo
         m_lastPacketReceiveTime = -1000.0;
         memset( m_connectTokenData, 0, ConnectTokenBytes );
         memset( m_connectTokenNonce, 0, NonceBytes );
+        m_connectTokenExpireTimestamp = 0;
+        m_connectTokenServerId = 0;
         memset( m_challengeTokenData, 0, ChallengeTokenBytes );
         memset( m_challengeTokenNonce, 0, NonceBytes );
         m_transport->ResetEncryptionMappings();
@@ -966,6 +1199,8 @@ namespace yojimbo
 
             memset( m_connectTokenData, 0, ConnectTokenBytes );
             memset( m_connectTokenNonce, 0, NonceBytes );
+            m_connectTokenExpireTimestamp = 0;
+            m_connectTokenServerId = 0;
             memset( m_challengeTokenData, 0, ChallengeTokenBytes );
             memset( m_challengeTokenNonce, 0, NonceBytes );
 
@@ -1067,6 +1302,28 @@ namespace yojimbo
 
     // =============================================================
 
+    static const int ReceivePacketsPerWorker = 32;
+
+    template <typename T> static T * allocate_client_array( Allocator & allocator, int numEntries )
+    {
+        T * array = (T*) allocator.Allocate( sizeof( T ) * numEntries );
+        if ( !array )
+            return NULL;
+        for ( int i = 0; i < numEntries; ++i )
+            new ( &array[i] ) T();
+        return array;
+    }
+
+    template <typename T> static void free_client_array( Allocator & allocator, T * & array, int numEntries )
+    {
+        if ( !array )
+            return;
+        for ( int i = 0; i < numEntries; ++i )
+            array[i].~T();
+        allocator.Free( array );
+        array = NULL;
+    }
+
     void Server::Defaults()
     {
         m_allocator = NULL;
@@ -1080,16 +1337,38 @@ namespace yojimbo
         m_challengeTokenNonce = 0;
         m_globalSequence = 0;
         m_globalContext = NULL;
+        m_challengePacket = NULL;
+        m_deniedPacket = NULL;
+        m_clientStreamAllocator = NULL;
+        m_clientContext = NULL;
+        m_clientMessageFactory = NULL;
+        m_clientPacketFactory = NULL;
+        m_globalMessageFactory = NULL;
+        m_sharedMessages = NULL;
+        m_clientConnected = NULL;
+        m_clientId = NULL;
+        m_clientSequence = NULL;
+        m_clientAddress = NULL;
+        m_clientData = NULL;
+        m_clientLastPacketSendTime = NULL;
+        m_clientLastHeartBeatSendTime = NULL;
+        m_clientLastPacketReceiveTime = NULL;
+        m_clientFullyConnected = NULL;
+        m_activeClients = NULL;
+        m_activeClientSlot = NULL;
+        m_timeOutTimers = NULL;
+        m_heartBeatTimers = NULL;
+        m_connection = NULL;
+        m_clientConnectionPacket = NULL;
+        m_workerPool = NULL;
+        m_receiveBatchSize = 0;
+        m_numReceiveEntries = 0;
+        m_receiveEntries = NULL;
+        m_numConnectTokenEntries = 0;
+        m_connectTokenEntries = NULL;
+        m_serverId = 0;
         memset( m_privateKey, 0, KeyBytes );
-        memset( m_clientStreamAllocator, 0, sizeof( m_clientStreamAllocator ) );
-        memset( m_clientContext, 0, sizeof( m_clientContext ) );
-        memset( m_clientMessageFactory, 0, sizeof( m_clientMessageFactory ) );
-        memset( m_clientPacketFactory, 0, sizeof( m_clientPacketFactory ) );
-        memset( m_connection, 0, sizeof( m_connection ) );
-        memset( m_clientSequence, 0, sizeof( m_clientSequence ) );
         memset( m_counters, 0, sizeof( m_counters ) );
-        for ( int i = 0; i < MaxClients; ++i )
-            ResetClientState( i );
     }
 
     Server::Server( Allocator & allocator, Transport & transport )
@@ -1116,6 +1395,8 @@ namespace yojimbo
 
         YOJIMBO_DELETE( *m_allocator, Allocator, m_globalStreamAllocator );
 
+        SetWorkerPool( NULL );
+
         assert( m_transport );
 
         m_transport = NULL;
@@ -1131,15 +1412,63 @@ namespace yojimbo
         m_serverAddress = address;
     }
 
-    void Server::Start( int maxClients )
+    void Server::SetServerId( uint64_t serverId )
+    {
+        m_serverId = serverId;
+    }
+
+    bool Server::Start( int maxClients )
     {
         assert( maxClients > 0 );
-        assert( maxClients <= MaxClients );
 
         Stop();
 
         m_maxClients = maxClients;
 
+        // per-client arrays are sized to the client capacity passed in, so it can be changed without recompiling
+
+        m_clientStreamAllocator = allocate_client_array<Allocator*>( *m_allocator, m_maxClients );
+        m_clientContext = allocate_client_array<ClientServerContext*>( *m_allocator, m_maxClients );
+        m_clientMessageFactory = allocate_client_array<MessageFactory*>( *m_allocator, m_maxClients );
+        m_clientPacketFactory = allocate_client_array<PacketFactory*>( *m_allocator, m_maxClients );
+        m_clientConnected = allocate_client_array<bool>( *m_allocator, m_maxClients );
+        m_clientId = allocate_client_array<uint64_t>( *m_allocator, m_maxClients );
+        m_clientSequence = allocate_client_array<uint64_t>( *m_allocator, m_maxClients );
+        m_clientAddress = allocate_client_array<Address>( *m_allocator, m_maxClients );
+        m_clientData = allocate_client_array<ServerClientData>( *m_allocator, m_maxClients );
+        m_clientLastPacketSendTime = allocate_client_array<double>( *m_allocator, m_maxClients );
+        m_clientLastHeartBeatSendTime = allocate_client_array<double>( *m_allocator, m_maxClients );
+        m_clientLastPacketReceiveTime = allocate_client_array<double>( *m_allocator, m_maxClients );
+        m_clientFullyConnected = allocate_client_array<bool>( *m_allocator, m_maxClients );
+        m_activeClients = allocate_client_array<int>( *m_allocator, m_maxClients );
+        m_activeClientSlot = allocate_client_array<int>( *m_allocator, m_maxClients );
+        m_connection = allocate_client_array<Connection*>( *m_allocator, m_maxClients );
+        m_clientConnectionPacket = allocate_client_array<ConnectionPacket*>( *m_allocator, m_maxClients );
+
+        m_numConnectTokenEntries = m_maxClients * ConnectTokenEntriesPerClient;
+        m_connectTokenEntries = allocate_client_array<ConnectTokenEntry>( *m_allocator, m_numConnectTokenEntries );
+
+        if ( !m_clientStreamAllocator || !m_clientContext || !m_clientMessageFactory || !m_clientPacketFactory ||
+             !m_clientConnected || !m_clientId || !m_clientSequence || !m_clientAddress || !m_clientData ||
+             !m_clientLastPacketSendTime || !m_clientLastHeartBeatSendTime || !m_clientLastPacketReceiveTime ||
+             !m_clientFullyConnected || !m_activeClients || !m_activeClientSlot || !m_connection ||
+             !m_clientConnectionPacket || !m_connectTokenEntries )
+        {
+            debug_printf( "failed to allocate per-client state for %d clients\n", maxClients );
+            FreeClientArrays();
+            return false;
+        }
+
+        m_timeOutTimers = YOJIMBO_NEW( *m_allocator, TimerWheel, *m_allocator, m_maxClients, ServerTimerResolution, GetTime() );
+        m_heartBeatTimers = YOJIMBO_NEW( *m_allocator, TimerWheel, *m_allocator, m_maxClients, ServerTimerResolution, GetTime() );
+
+        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+            ResetClientState( clientIndex );
+
+        uint64_t rateLimitSeed;
+        RandomBytes( (uint8_t*) &rateLimitSeed, sizeof( rateLimitSeed ) );
+        m_handshakeRateLimiter.Reset( rateLimitSeed, GetTime() );
+
         if ( !m_globalStreamAllocator )
         {
             m_globalStreamAllocator = CreateStreamAllocator( SERVER_RESOURCE_GLOBAL, -1 );
@@ -1172,14 +1501,31 @@ namespace yojimbo
                 m_clientContext[clientIndex] = CreateContext( SERVER_RESOURCE_PER_CLIENT, clientIndex );
 
                 assert( m_clientContext[clientIndex]->magic == ConnectionContextMagic );
+
+                m_connection[clientIndex]->SetContext( m_clientContext[clientIndex] );
             }
+
+            m_globalMessageFactory = CreateMessageFactory( -1 );
         }
 
         SetEncryptedPacketTypes();
 
         InitializeGlobalContext();
 
+        m_challengePacket = (ConnectionChallengePacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_CONNECTION_CHALLENGE );
+        m_deniedPacket = (ConnectionDeniedPacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_CONNECTION_DENIED );
+
+        if ( !m_challengePacket || !m_deniedPacket )
+        {
+            debug_printf( "failed to preallocate connection request reply packets\n" );
+            m_counters[SERVER_COUNTER_GLOBAL_PACKET_FACTORY_ERRORS]++;
+        }
+
+        m_transport->SetListener( this );
+
         OnStart( maxClients );
+
+        return true;
     }
 
     void Server::Stop()
@@ -1191,8 +1537,34 @@ namespace yojimbo
 
         DisconnectAllClients();
 
+        m_transport->SetListener( NULL );
+
+        if ( m_challengePacket )
+        {
+            m_challengePacket->Destroy();
+            m_challengePacket = NULL;
+        }
+
+        if ( m_deniedPacket )
+        {
+            m_deniedPacket->Destroy();
+            m_deniedPacket = NULL;
+        }
+
         m_transport->Reset();
 
+        // every connection has been reset and every queued packet destroyed, so nothing else references the broadcast messages now
+
+        ReleaseSharedMessages();
+
+        assert( !m_sharedMessages );
+
+        m_transport->SetContext( NULL );
+
+        YOJIMBO_DELETE( *m_allocator, ClientServerContext, m_globalContext );
+
+        YOJIMBO_DELETE( *m_allocator, MessageFactory, m_globalMessageFactory );
+
         for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
         {
             YOJIMBO_DELETE( *m_allocator, ClientServerContext, m_clientContext[clientIndex] );
@@ -1206,6 +1578,35 @@ namespace yojimbo
             YOJIMBO_DELETE( *m_allocator, Allocator, m_clientStreamAllocator[clientIndex] );
         }
 
+        FreeClientArrays();
+    }
+
+    void Server::FreeClientArrays()
+    {
+        free_client_array( *m_allocator, m_clientStreamAllocator, m_maxClients );
+        free_client_array( *m_allocator, m_clientContext, m_maxClients );
+        free_client_array( *m_allocator, m_clientMessageFactory, m_maxClients );
+        free_client_array( *m_allocator, m_clientPacketFactory, m_maxClients );
+        free_client_array( *m_allocator, m_clientConnected, m_maxClients );
+        free_client_array( *m_allocator, m_clientId, m_maxClients );
+        free_client_array( *m_allocator, m_clientSequence, m_maxClients );
+        free_client_array( *m_allocator, m_clientAddress, m_maxClients );
+        free_client_array( *m_allocator, m_clientData, m_maxClients );
+        free_client_array( *m_allocator, m_clientLastPacketSendTime, m_maxClients );
+        free_client_array( *m_allocator, m_clientLastHeartBeatSendTime, m_maxClients );
+        free_client_array( *m_allocator, m_clientLastPacketReceiveTime, m_maxClients );
+        free_client_array( *m_allocator, m_clientFullyConnected, m_maxClients );
+        free_client_array( *m_allocator, m_activeClients, m_maxClients );
+        free_client_array( *m_allocator, m_activeClientSlot, m_maxClients );
+        free_client_array( *m_allocator, m_connection, m_maxClients );
+        free_client_array( *m_allocator, m_clientConnectionPacket, m_maxClients );
+        free_client_array( *m_allocator, m_connectTokenEntries, m_numConnectTokenEntries );
+
+        YOJIMBO_DELETE( *m_allocator, TimerWheel, m_timeOutTimers );
+        YOJIMBO_DELETE( *m_allocator, TimerWheel, m_heartBeatTimers );
+
+        m_numConnectTokenEntries = 0;
+
         m_maxClients = -1;
     }
 
@@ -1236,22 +1637,32 @@ namespace yojimbo
 
         m_transport->RemoveEncryptionMapping( m_clientData[clientIndex].address );
 
-        ResetClientState( clientIndex );
+        // swap remove from the active list. the last active client takes over the slot being vacated.
 
-        m_counters[SERVER_COUNTER_CLIENT_DISCONNECTS]++;
+        const int activeIndex = m_activeClientSlot[clientIndex];
+
+        assert( activeIndex >= 0 );
+        assert( activeIndex < m_numConnectedClients );
+        assert( m_activeClients[activeIndex] == clientIndex );
+
+        const int lastClientIndex = m_activeClients[m_numConnectedClients - 1];
+
+        m_activeClients[activeIndex] = lastClientIndex;
+        m_activeClientSlot[lastClientIndex] = activeIndex;
 
         m_numConnectedClients--;
+
+        ResetClientState( clientIndex );
+
+        m_counters[SERVER_COUNTER_CLIENT_DISCONNECTS]++;
     }
 
     void Server::DisconnectAllClients( bool sendDisconnectPacket )
     {
         assert( IsRunning() );
 
-        for ( int i = 0; i < m_maxClients; ++i )
-        {
-            if ( m_clientConnected[i] )
-                DisconnectClient( i, sendDisconnectPacket );
-        }
+        while ( m_numConnectedClients > 0 )
+            DisconnectClient( m_activeClients[m_numConnectedClients - 1], sendDisconnectPacket );
     }
 
     Message * Server::CreateMessage( int clientIndex, int type )
@@ -1325,6 +1736,104 @@ namespace yojimbo
         return *m_clientMessageFactory[clientIndex];
     }
 
+    Message * Server::CreateGlobalMessage( int type )
+    {
+        assert( m_globalMessageFactory );
+        return m_globalMessageFactory->Create( type );
+    }
+
+    void Server::ReleaseGlobalMessage( Message * message )
+    {
+        assert( message );
+        assert( m_globalMessageFactory );
+        m_globalMessageFactory->Release( message );
+    }
+
+    void Server::BroadcastMessage( Message * message, const uint64_t * clientMask )
+    {
+        // Sends a message created with CreateGlobalMessage to every connected client, or just the clients set in clientMask,
+        // a bit per-client index packed 64 to a word. The message is serialized once and the bits are shared by each connection.
+
+        assert( message );
+        assert( m_globalMessageFactory );
+
+        if ( message->IsBlockMessage() )
+        {
+            // block data is split into fragments that each client acks on its own, so it can't be shared between connections
+
+            debug_printf( "block messages cannot be broadcast\n" );
+            m_counters[SERVER_COUNTER_BROADCAST_MESSAGE_CAPTURE_FAILURES]++;
+            m_globalMessageFactory->Release( message );
+            return;
+        }
+
+        SharedMessage * sharedMessage = YOJIMBO_NEW( *m_allocator, SharedMessage, *m_allocator );
+
+        if ( !sharedMessage->Capture( *message, m_globalContext ) )
+        {
+            debug_printf( "failed to serialize broadcast message\n" );
+            m_counters[SERVER_COUNTER_BROADCAST_MESSAGE_CAPTURE_FAILURES]++;
+            m_globalMessageFactory->Release( sharedMessage );
+            m_globalMessageFactory->Release( message );
+            return;
+        }
+
+        m_globalMessageFactory->Release( message );
+
+        for ( int activeIndex = 0; activeIndex < m_numConnectedClients; ++activeIndex )
+        {
+            const int clientIndex = m_activeClients[activeIndex];
+
+            if ( clientMask && !( clientMask[clientIndex/64] & ( uint64_t(1) << ( clientIndex % 64 ) ) ) )
+                continue;
+
+            assert( m_connection[clientIndex] );
+
+            m_globalMessageFactory->AddRef( sharedMessage );
+
+            m_connection[clientIndex]->SendMessage( sharedMessage );
+        }
+
+        // the server keeps a reference until the connections are done with the message. see ReleaseSharedMessages.
+
+        sharedMessage->SetNext( m_sharedMessages );
+
+        m_sharedMessages = sharedMessage;
+
+        m_counters[SERVER_COUNTER_BROADCAST_MESSAGES_SENT]++;
+    }
+
+    void Server::ReleaseSharedMessages()
+    {
+        // IMPORTANT: connections release their references to shared messages on worker threads, but the last reference is always
+        // the server's and it is only dropped here. this keeps freeing shared messages on the thread that owns the server allocator.
+
+        SharedMessage * previous = NULL;
+
+        SharedMessage * sharedMessage = m_sharedMessages;
+
+        while ( sharedMessage )
+        {
+            SharedMessage * next = sharedMessage->GetNext();
+
+            if ( sharedMessage->GetRefCount() == 1 )
+            {
+                if ( previous )
+                    previous->SetNext( next );
+                else
+                    m_sharedMessages = next;
+
+                m_globalMessageFactory->Release( sharedMessage );
+            }
+            else
+            {
+                previous = sharedMessage;
+            }
+
+            sharedMessage = next;
+        }
+    }
+
     Packet * Server::CreateGlobalPacket( int type )
     {
         return m_transport->CreatePacket( type );
@@ -1345,54 +1854,101 @@ namespace yojimbo
 
         const double time = GetTime();
 
-        for ( int i = 0; i < m_maxClients; ++i )
+        // generating connection packets walks every channel for every client, and clients are independent of each other.
+        // with a worker pool, packets are generated in parallel up front, then sent from here in active client order as before.
+
+        const bool parallel = m_workerPool && m_workerPool->GetNumWorkers() > 1;
+
+        if ( parallel )
+            m_workerPool->Run( GenerateClientPacketsWorker, this );
+
+        for ( int activeIndex = 0; activeIndex < m_numConnectedClients; ++activeIndex )
         {
-            if ( !m_clientConnected[i] )
-                continue;
+            const int i = m_activeClients[activeIndex];
 
-            if ( m_clientData[i].fullyConnected )
+            assert( m_clientConnected[i] );
+
+            if ( m_clientFullyConnected[i] && m_connection[i] )
             {
-                if ( m_connection[i] )
-                {
-                    ConnectionPacket * packet = m_connection[i]->GeneratePacket();
+                ConnectionPacket * packet = parallel ? m_clientConnectionPacket[i] : m_connection[i]->GeneratePacket();
 
-                    if ( packet )
-                    {
-                        SendPacketToConnectedClient( i, packet );
-                    }
-                }
+                m_clientConnectionPacket[i] = NULL;
 
-                if ( m_clientData[i].lastPacketSendTime + ConnectionHeartBeatRate <= time )
+                if ( packet )
                 {
-                    ConnectionHeartBeatPacket * packet = CreateHeartBeatPacket( i );
-
-                    if ( packet )
-                    {
-                        SendPacketToConnectedClient( i, packet );
-
-                        m_clientData[i].lastHeartBeatSendTime = GetTime();
-                    }
+                    SendPacketToConnectedClient( i, packet );
                 }
             }
-            else
+        }
+
+        // heartbeats only go to clients we haven't sent anything to for a while. the heartbeat timer wheel hands back just
+        // the clients that may be due. sending anything pushes the real deadline back, so it is checked again here.
+
+        m_heartBeatTimers->Advance( time );
+
+        while ( true )
+        {
+            const int clientIndex = m_heartBeatTimers->PopExpired();
+
+            if ( clientIndex == -1 )
+                break;
+
+            assert( m_clientConnected[clientIndex] );
+
+            const double lastSendTime = m_clientFullyConnected[clientIndex] ? m_clientLastPacketSendTime[clientIndex] : m_clientLastHeartBeatSendTime[clientIndex];
+
+            if ( lastSendTime + ConnectionHeartBeatRate <= time )
             {
-                if ( m_clientData[i].lastHeartBeatSendTime + ConnectionHeartBeatRate <= time )
-                {
-                    ConnectionHeartBeatPacket * packet = CreateHeartBeatPacket( i );
+                ConnectionHeartBeatPacket * packet = CreateHeartBeatPacket( clientIndex );
 
-                    if ( packet )
-                    {
-                        SendPacketToConnectedClient( i, packet );
+                if ( packet )
+                {
+                    SendPacketToConnectedClient( clientIndex, packet );
 
-                        m_clientData[i].lastHeartBeatSendTime = GetTime();
-                    }
+                    m_clientLastHeartBeatSendTime[clientIndex] = GetTime();
                 }
             }
+
+            const double nextSendTime = m_clientFullyConnected[clientIndex] ? m_clientLastPacketSendTime[clientIndex] : m_clientLastHeartBeatSendTime[clientIndex];
+
+            m_heartBeatTimers->Schedule( clientIndex, nextSendTime + ConnectionHeartBeatRate );
+        }
+    }
+
+    void Server::GenerateClientPacketsWorker( void * data, int workerIndex )
+    {
+        Server * server = (Server*) data;
+        server->GenerateClientPackets( workerIndex );
+    }
+
+    void Server::GenerateClientPackets( int workerIndex )
+    {
+        // IMPORTANT: this runs on worker threads. it must only touch state belonging to client slots in this worker's range.
+
+        const int numWorkers = m_workerPool->GetNumWorkers();
+
+        const int begin = ( m_numConnectedClients * workerIndex ) / numWorkers;
+        const int end = ( m_numConnectedClients * ( workerIndex + 1 ) ) / numWorkers;
+
+        for ( int activeIndex = begin; activeIndex < end; ++activeIndex )
+        {
+            const int i = m_activeClients[activeIndex];
+
+            assert( m_clientConnectionPacket[i] == NULL );
+
+            if ( m_clientFullyConnected[i] && m_connection[i] )
+                m_clientConnectionPacket[i] = m_connection[i]->GeneratePacket();
         }
     }
 
     void Server::ReceivePackets()
     {
+        if ( m_workerPool && m_workerPool->GetNumWorkers() > 1 )
+        {
+            ReceivePacketsParallel();
+            return;
+        }
+
         while ( true )
         {
             Address address;
@@ -1409,6 +1965,105 @@ namespace yojimbo
         }
     }
 
+    void Server::ReceivePacketsParallel()
+    {
+        assert( m_receiveEntries );
+
+        // connection packets from connected clients are batched up and processed by the worker that owns the client slot.
+        // everything else is processed here, in order. received messages land in the per-client connection receive queues.
+
+        m_numReceiveEntries = 0;
+
+        while ( true )
+        {
+            Address address;
+            uint64_t sequence;
+            Packet * packet = m_transport->ReceivePacket( address, &sequence );
+
+            if ( !packet )
+                break;
+
+            if ( !IsRunning() )
+            {
+                packet->Destroy();
+                continue;
+            }
+
+            const int clientIndex = FindExistingClientIndex( address );
+
+            if ( clientIndex != -1 && packet->GetType() == CLIENT_SERVER_PACKET_CONNECTION )
+            {
+                OnPacketReceived( packet->GetType(), address, sequence );
+
+                ReceiveEntry & entry = m_receiveEntries[m_numReceiveEntries++];
+                entry.packet = (ConnectionPacket*) packet;
+                entry.clientIndex = clientIndex;
+
+                if ( m_numReceiveEntries == m_receiveBatchSize )
+                    ProcessReceiveEntries();
+
+                continue;
+            }
+
+            // IMPORTANT: packets queued for this client must be processed before anything that can change its state, eg. disconnect.
+
+            if ( clientIndex != -1 )
+                ProcessReceiveEntries();
+
+            ProcessPacket( packet, address, sequence );
+
+            packet->Destroy();
+        }
+
+        ProcessReceiveEntries();
+    }
+
+    void Server::ProcessReceiveEntries()
+    {
+        if ( m_numReceiveEntries == 0 )
+            return;
+
+        m_workerPool->Run( ProcessClientPacketsWorker, this );
+
+        for ( int i = 0; i < m_numReceiveEntries; ++i )
+        {
+            m_receiveEntries[i].packet->Destroy();
+            m_receiveEntries[i].packet = NULL;
+        }
+
+        m_numReceiveEntries = 0;
+    }
+
+    void Server::ProcessClientPacketsWorker( void * data, int workerIndex )
+    {
+        Server * server = (Server*) data;
+        server->ProcessClientPackets( workerIndex );
+    }
+
+    void Server::ProcessClientPackets( int workerIndex )
+    {
+        // IMPORTANT: this runs on worker threads. it must only touch state belonging to client slots owned by this worker.
+
+        const int numWorkers = m_workerPool->GetNumWorkers();
+
+        const double time = GetTime();
+
+        for ( int i = 0; i < m_numReceiveEntries; ++i )
+        {
+            const int clientIndex = m_receiveEntries[i].clientIndex;
+
+            if ( clientIndex % numWorkers != workerIndex )
+                continue;
+
+            if ( m_connection[clientIndex] )
+                m_connection[clientIndex]->ProcessPacket( m_receiveEntries[i].packet );
+
+            m_clientLastPacketReceiveTime[clientIndex] = time;
+
+            m_clientFullyConnected[clientIndex] = true;
+        }
+    }
+
     void Server::CheckForTimeOut()
     {
         if ( !IsRunning() )
@@ -1416,12 +2071,22 @@ namespace yojimbo
 
         const double time = GetTime();
 
-        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+        // receiving a packet pushes the real deadline back without touching the timer wheel, so it is checked again here
+
+        m_timeOutTimers->Advance( time );
+
+        while ( true )
         {
-            if ( !m_clientConnected[clientIndex] )
-                continue;
+            const int clientIndex = m_timeOutTimers->PopExpired();
+
+            if ( clientIndex == -1 )
+                break;
 
-            if ( m_clientData[clientIndex].lastPacketReceiveTime + ConnectionTimeOut < time )
+            assert( m_clientConnected[clientIndex] );
+
+            const double deadline = m_clientLastPacketReceiveTime[clientIndex] + ConnectionTimeOut;
+
+            if ( deadline < time )
             {
                 OnClientError( clientIndex, SERVER_CLIENT_ERROR_TIMEOUT );
 
@@ -1429,6 +2094,10 @@ namespace yojimbo
 
                 DisconnectClient( clientIndex, false );
             }
+            else
+            {
+                m_timeOutTimers->Schedule( clientIndex, deadline );
+            }
         }
     }
 
@@ -1438,6 +2107,8 @@ namespace yojimbo
 
         m_time = time;
 
+        ReleaseSharedMessages();
+
         // check for global stream allocator error, increase counter and clear error. nothing we can do but take note.
 
         if ( m_globalStreamAllocator->GetError() )
@@ -1458,60 +2129,67 @@ namespace yojimbo
             globalPacketFactory->ClearError();
         }
 
-        for ( int clientIndex = 0; clientIndex < m_maxClients; ++clientIndex )
+        // walk the active list backwards, so a client disconnected below never causes another to be skipped
+
+        for ( int activeIndex = m_numConnectedClients - 1; activeIndex >= 0; --activeIndex )
         {
-            if ( IsClientConnected( clientIndex ) )
+            const int clientIndex = m_activeClients[activeIndex];
+
+            // check for stream allocator error
+
+            if ( m_clientStreamAllocator[clientIndex]->GetError() )
             {
-                // check for stream allocator error
+                OnClientError( clientIndex, SERVER_CLIENT_ERROR_STREAM_ALLOCATOR );
 
-                if ( m_clientStreamAllocator[clientIndex]->GetError() )
-                {
-                    OnClientError( clientIndex, SERVER_CLIENT_ERROR_STREAM_ALLOCATOR );
+                m_counters[SERVER_COUNTER_CLIENT_STREAM_ALLOCATOR_ERRORS]++;
 
-                    m_counters[SERVER_COUNTER_CLIENT_STREAM_ALLOCATOR_ERRORS]++;
+                DisconnectClient( clientIndex, true );
 
-                    DisconnectClient( clientIndex, true );
-                }
+                continue;
+            }
 
-                // check for message factory error
+            // check for message factory error
 
-                if ( m_clientMessageFactory[clientIndex] )
+            if ( m_clientMessageFactory[clientIndex] )
+            {
+                if ( m_clientMessageFactory[clientIndex]->GetError() )
                 {
-                    if ( m_clientMessageFactory[clientIndex]->GetError() )
-                    {
-                        OnClientError( clientIndex, SERVER_CLIENT_ERROR_MESSAGE_FACTORY );
+                    OnClientError( clientIndex, SERVER_CLIENT_ERROR_MESSAGE_FACTORY );
 
-                        m_counters[SERVER_COUNTER_CLIENT_MESSAGE_FACTORY_ERRORS]++;
+                    m_counters[SERVER_COUNTER_CLIENT_MESSAGE_FACTORY_ERRORS]++;
 
-                        DisconnectClient( clientIndex, true );
-                    }
+                    DisconnectClient( clientIndex, true );
+
+                    continue;
                 }
+            }
 
-                // check for packet factory error
+            // check for packet factory error
 
-                if ( m_clientPacketFactory[clientIndex]->GetError() )
-                {
-                    OnClientError( clientIndex, SERVER_CLIENT_ERROR_PACKET_FACTORY );
+            if ( m_clientPacketFactory[clientIndex]->GetError() )
+            {
+                OnClientError( clientIndex, SERVER_CLIENT_ERROR_PACKET_FACTORY );
 
-                    m_counters[SERVER_COUNTER_CLIENT_PACKET_FACTORY_ERRORS]++;
+                m_counters[SERVER_COUNTER_CLIENT_PACKET_FACTORY_ERRORS]++;
 
-                    DisconnectClient( clientIndex, true );
-                }
+                DisconnectClient( clientIndex, true );
 
-                // check for connection error
+                continue;
+            }
 
-                if ( m_connection[clientIndex] )
-                {
-                    m_connection[clientIndex]->AdvanceTime( time );
+            // check for connection error
 
-                    if ( m_connection[clientIndex]->GetError() )
-                    {
-                        OnClientError( clientIndex, SERVER_CLIENT_ERROR_CONNECTION );
+            if ( m_connection[clientIndex] )
+            {
+                m_connection[clientIndex]->AdvanceTime( time );
 
-                        m_counters[SERVER_COUNTER_CLIENT_CONNECTION_ERRORS]++;
+                if ( m_connection[clientIndex]->GetError() )
+                {
+                    OnClientError( clientIndex, SERVER_CLIENT_ERROR_CONNECTION );
 
-                        DisconnectClient( clientIndex, true );
-                    }
+                    m_counters[SERVER_COUNTER_CLIENT_CONNECTION_ERRORS]++;
+
+                    DisconnectClient( clientIndex, true );
                 }
             }
         }
@@ -1522,6 +2200,33 @@ namespace yojimbo
         m_flags = flags;
     }
 
+    void Server::SetWorkerPool( WorkerPool * workerPool )
+    {
+        // IMPORTANT: with a worker pool, per-client message factories, packet factories and their allocators are used from
+        // worker threads. They must be unique per-client or thread safe. The default allocator is thread safe.
+        // OnConnectionPacketReceived, OnConnectionPacketAcked, OnConnectionFragmentReceived and OnConnectionBlockData are called from workers too.
+
+        if ( m_receiveEntries )
+        {
+            m_allocator->Free( m_receiveEntries );
+            m_receiveEntries = NULL;
+        }
+
+        m_receiveBatchSize = 0;
+        m_numReceiveEntries = 0;
+
+        m_workerPool = workerPool;
+
+        if ( !m_workerPool || m_workerPool->GetNumWorkers() <= 1 )
+            return;
+
+        m_receiveBatchSize = m_workerPool->GetNumWorkers() * ReceivePacketsPerWorker;
+
+        m_receiveEntries = (ReceiveEntry*) m_allocator->Allocate( sizeof( ReceiveEntry ) * m_receiveBatchSize );
+
+        memset( m_receiveEntries, 0, sizeof( ReceiveEntry ) * m_receiveBatchSize );
+    }
+
     bool Server::IsRunning() const
     {
         return m_maxClients > 0;
@@ -1549,9 +2254,10 @@ namespace yojimbo
         if ( !address.IsValid() )
             return -1;
 
-        for ( int i = 0; i < m_maxClients; ++i )
-        {   
-            if ( m_clientConnected[i] && m_clientAddress[i] == address )
+        for ( int activeIndex = 0; activeIndex < m_numConnectedClients; ++activeIndex )
+        {
+            const int i = m_activeClients[activeIndex];
+            if ( m_clientAddress[i] == address )
                 return i;
         }
 
@@ -1572,6 +2278,19 @@ namespace yojimbo
         return m_clientAddress[clientIndex];
     }
 
+    bool Server::GetConnectionStats( int clientIndex, ConnectionStats & stats ) const
+    {
+        assert( clientIndex >= 0 );
+        assert( clientIndex < m_maxClients );
+
+        if ( !m_clientConnected[clientIndex] || !m_connection[clientIndex] )
+            return false;
+
+        m_connection[clientIndex]->GetStats( stats );
+
+        return true;
+    }
+
     int Server::GetNumConnectedClients() const
     {
         return m_numConnectedClients;
@@ -1645,12 +2364,24 @@ namespace yojimbo
     void Server::ResetClientState( int clientIndex )
     {
         assert( clientIndex >= 0 );
-        assert( clientIndex < MaxClients );
+        assert( clientIndex < m_maxClients );
         m_clientConnected[clientIndex] = false;
         m_clientId[clientIndex] = 0;
         m_clientAddress[clientIndex] = Address();
         m_clientData[clientIndex] = ServerClientData();
         m_clientSequence[clientIndex] = 0;
+        m_clientLastPacketSendTime[clientIndex] = 0.0;
+        m_clientLastHeartBeatSendTime[clientIndex] = 0.0;
+        m_clientLastPacketReceiveTime[clientIndex] = 0.0;
+        m_clientFullyConnected[clientIndex] = false;
+        m_activeClientSlot[clientIndex] = -1;
+        m_timeOutTimers->Cancel( clientIndex );
+        m_heartBeatTimers->Cancel( clientIndex );
+
+        // drop anything still queued for the old client, including its references to broadcast messages
+
+        if ( m_connection[clientIndex] )
+            m_connection[clientIndex]->Reset();
     }
 
     int Server::FindFreeClientIndex() const
@@ -1665,9 +2396,10 @@ namespace yojimbo
 
     int Server::FindExistingClientIndex( const Address & address ) const
     {
-        for ( int i = 0; i < m_maxClients; ++i )
+        for ( int activeIndex = 0; activeIndex < m_numConnectedClients; ++activeIndex )
         {
-            if ( m_clientConnected[i] && m_clientAddress[i] == address )
+            const int i = m_activeClients[activeIndex];
+            if ( m_clientAddress[i] == address )
                 return i;
         }
         return -1;
@@ -1675,19 +2407,36 @@ namespace yojimbo
 
     int Server::FindExistingClientIndex( const Address & address, uint64_t clientId ) const
     {
-        for ( int i = 0; i < m_maxClients; ++i )
+        for ( int activeIndex = 0; activeIndex < m_numConnectedClients; ++activeIndex )
         {
-            if ( m_clientId[i] == clientId && m_clientConnected[i] && m_clientAddress[i] == address )
+            const int i = m_activeClients[activeIndex];
+            if ( m_clientId[i] == clientId && m_clientAddress[i] == address )
                 return i;
         }
         return -1;
     }
 
+    ConnectTokenEntry * Server::GetConnectTokenBucket( const uint8_t * mac )
+    {
+        // the mac is authenticated by our private key, so clients can't pick macs that pile up in one bucket
+
+        assert( mac );
+        assert( m_numConnectTokenEntries % ConnectTokenEntriesPerBucket == 0 );
+
+        const int numBuckets = m_numConnectTokenEntries / ConnectTokenEntriesPerBucket;
+
+        const int bucketIndex = (int) ( murmur_hash_64( mac, MacBytes, 0 ) % numBuckets );
+
+        return &m_connectTokenEntries[bucketIndex*ConnectTokenEntriesPerBucket];
+    }
+
     bool Server::FindConnectTokenEntry( const uint8_t * mac )
     {
-        for ( int i = 0; i < MaxConnectTokenEntries; ++i )
+        ConnectTokenEntry * bucket = GetConnectTokenBucket( mac );
+
+        for ( int i = 0; i < ConnectTokenEntriesPerBucket; ++i )
         {
-            if ( memcmp( mac, m_connectTokenEntries[i].mac, MacBytes ) == 0 )
+            if ( memcmp( mac, bucket[i].mac, MacBytes ) == 0 )
                 return true;
         }
 
@@ -1696,7 +2445,8 @@ namespace yojimbo
 
     bool Server::FindOrAddConnectTokenEntry( const Address & address, const uint8_t * mac )
     {
-        // find the matching entry for the token mac, and the oldest token. constant time worst case O(1) at all times. This is intentional!
+        // find the matching entry for the token mac, and the oldest token in its bucket. only the bucket the mac hashes to is searched,
+        // so the cost is O(1) and does not grow with the number of clients.
 
         const double time = GetTime();
 
@@ -1704,41 +2454,43 @@ namespace yojimbo
 
         assert( mac );
 
+        ConnectTokenEntry * bucket = GetConnectTokenBucket( mac );
+
         int matchingTokenIndex = -1;
         int oldestTokenIndex = -1;
         double oldestTokenTime = 0.0;
-        for ( int i = 0; i < MaxConnectTokenEntries; ++i )
+        for ( int i = 0; i < ConnectTokenEntriesPerBucket; ++i )
         {
-            if ( memcmp( mac, m_connectTokenEntries[i].mac, MacBytes ) == 0 )
+            if ( memcmp( mac, bucket[i].mac, MacBytes ) == 0 )
             {
                 matchingTokenIndex = i;
             }
 
-            if ( oldestTokenIndex == -1 || m_connectTokenEntries[i].time < oldestTokenTime )
+            if ( oldestTokenIndex == -1 || bucket[i].time < oldestTokenTime )
             {
-                oldestTokenTime = m_connectTokenEntries[i].time;
+                oldestTokenTime = bucket[i].time;
                 oldestTokenIndex = i;
             }
         }
 
-        // if no entry is found with the mac, replace the oldest entry with this (mac,address,time) and return true
+        // if no entry is found with the mac, replace the oldest entry in the bucket with this (mac,address,time) and return true
 
         assert( oldestTokenIndex != -1 );
 
         if ( matchingTokenIndex == -1 )
         {
-            m_connectTokenEntries[oldestTokenIndex].time = time;
-            m_connectTokenEntries[oldestTokenIndex].address = address;
-            memcpy( m_connectTokenEntries[oldestTokenIndex].mac, mac, MacBytes );
+            bucket[oldestTokenIndex].time = time;
+            bucket[oldestTokenIndex].address = address;
+            memcpy( bucket[oldestTokenIndex].mac, mac, MacBytes );
             return true;
         }
 
         // if an entry is found with the same mac *and* it has the same address, return true
 
         assert( matchingTokenIndex >= 0 );
-        assert( matchingTokenIndex < MaxConnectTokenEntries );
+        assert( matchingTokenIndex < ConnectTokenEntriesPerBucket );
 
-        if ( m_connectTokenEntries[matchingTokenIndex].address == address )
+        if ( bucket[matchingTokenIndex].address == address )
             return true;
 
         // otherwise an entry exists with the same mac but a different address, somebody is trying to reuse the connect token as a replay attack!
@@ -1759,6 +2511,11 @@ namespace yojimbo
 
         m_counters[SERVER_COUNTER_CLIENT_CONNECTS]++;
 
+        assert( m_activeClientSlot[clientIndex] == -1 );
+
+        m_activeClients[m_numConnectedClients] = clientIndex;
+        m_activeClientSlot[clientIndex] = m_numConnectedClients;
+
         m_numConnectedClients++;
 
         m_clientConnected[clientIndex] = true;
@@ -1768,9 +2525,12 @@ namespace yojimbo
         m_clientData[clientIndex].address = clientAddress;
         m_clientData[clientIndex].clientId = clientId;
         m_clientData[clientIndex].connectTime = time;
-        m_clientData[clientIndex].lastPacketSendTime = time;
-        m_clientData[clientIndex].lastPacketReceiveTime = time;
-        m_clientData[clientIndex].fullyConnected = false;
+        m_clientLastPacketSendTime[clientIndex] = time;
+        m_clientLastPacketReceiveTime[clientIndex] = time;
+        m_clientFullyConnected[clientIndex] = false;
+
+        m_timeOutTimers->Schedule( clientIndex, time + ConnectionTimeOut );
+        m_heartBeatTimers->Schedule( clientIndex, m_clientLastHeartBeatSendTime[clientIndex] + ConnectionHeartBeatRate );
 
         assert( m_clientPacketFactory[clientIndex] );
         assert( m_clientStreamAllocator[clientIndex] );
@@ -1789,10 +2549,9 @@ namespace yojimbo
 
     int Server::FindClientId( uint64_t clientId ) const
     {
-        for ( int i = 0; i < m_maxClients; ++i )
+        for ( int activeIndex = 0; activeIndex < m_numConnectedClients; ++activeIndex )
         {
-            if ( !m_clientConnected[i] )
-                continue;
+            const int i = m_activeClients[activeIndex];
             if ( m_clientId[i] == clientId )
                 return i;
         }
@@ -1801,10 +2560,9 @@ namespace yojimbo
 
     int Server::FindAddressAndClientId( const Address & address, uint64_t clientId ) const
     {
-        for ( int i = 0; i < m_maxClients; ++i )
+        for ( int activeIndex = 0; activeIndex < m_numConnectedClients; ++activeIndex )
         {
-            if ( !m_clientConnected[i] )
-                continue;
+            const int i = m_activeClients[activeIndex];
             if ( m_clientAddress[i] == address && m_clientId[i] == clientId )
                 return i;
         }
@@ -1820,6 +2578,21 @@ namespace yojimbo
         OnPacketSent( packet->GetType(), address, immediate );
     }
 
+    void Server::SendConnectionDenied( const Address & address )
+    {
+        assert( IsRunning() );
+
+        // IMPORTANT: the denied packet is preallocated in start and sent immediately, so the transport never takes
+        // ownership of it. A client spamming a full server costs us no allocations.
+
+        if ( !m_deniedPacket )
+            return;
+
+        m_transport->SendPacketImmediate( address, m_deniedPacket, ++m_globalSequence );
+
+        OnPacketSent( CLIENT_SERVER_PACKET_CONNECTION_DENIED, address, true );
+    }
+
     void Server::SendPacketToConnectedClient( int clientIndex, Packet * packet, bool immediate )
     {
         assert( IsRunning() );
@@ -1830,13 +2603,54 @@ namespace yojimbo
 
         const double time = GetTime();
         
-        m_clientData[clientIndex].lastPacketSendTime = time;
+        m_clientLastPacketSendTime[clientIndex] = time;
         
         m_transport->SendPacket( m_clientAddress[clientIndex], packet, ++m_clientSequence[clientIndex], immediate );
         
         OnPacketSent( packet->GetType(), m_clientAddress[clientIndex], immediate );
     }
 
+    bool Server::ProcessRawPacket( const Address & from, const uint8_t * packetData, int packetBytes )
+    {
+        assert( packetData );
+        assert( packetBytes > 0 );
+
+        // IMPORTANT: connection requests are answered straight from the datagram, so a flood of them never
+        // touches the packet factory or the stream allocator. Everything else falls through to the transport.
+
+        if ( !IsRunning() )
+            return false;
+
+        // connection requests are always sent unencrypted, and unencrypted packets are written with a zero prefix byte
+
+        if ( packetData[0] != 0 )
+            return false;
+
+        PacketReadWriteInfo info;
+        info.context = m_globalContext;
+        info.protocolId = m_transport->GetProtocolId();
+        info.packetFactory = m_transport->GetPacketFactory();
+        info.streamAllocator = m_globalStreamAllocator;
+        info.prefixBytes = 1;
+
+        ConnectionRequestPacket packet;
+
+        int readError;
+
+        if ( !ReadPacketInPlace( info, packetData, packetBytes, CLIENT_SERVER_PACKET_CONNECTION_REQUEST, packet, &readError ) )
+        {
+            // only swallow packets we know to be broken connection requests. anything else is left to the transport.
+
+            return readError == YOJIMBO_PROTOCOL_ERROR_SERIALIZE_PACKET_FAILED || readError == YOJIMBO_PROTOCOL_ERROR_SERIALIZE_CHECK_FAILED;
+        }
+
+        OnPacketReceived( CLIENT_SERVER_PACKET_CONNECTION_REQUEST, from, 0 );
+
+        ProcessConnectionRequest( packet, from );
+
+        return true;
+    }
+
     void Server::ProcessConnectionRequest( const ConnectionRequestPacket & packet, const Address & address )
     {
         assert( IsRunning() );
@@ -1849,14 +2663,57 @@ namespace yojimbo
 
         m_counters[SERVER_COUNTER_CONNECTION_REQUEST_PACKETS_RECEIVED]++;
 
+        // IMPORTANT: protocol id, expiry timestamp and server id are sent in the clear and authenticated as additional data.
+        // This lets us reject stale and foreign connection requests with an integer compare, before doing any crypto.
+
+        if ( packet.connectTokenProtocolId != m_transport->GetProtocolId() )
+        {
+            debug_printf( "connect token protocol id mismatch\n" );
+            m_counters[SERVER_COUNTER_CONNECT_TOKEN_PROTOCOL_ID_MISMATCH]++;
+            return;
+        }
+
+        if ( packet.connectTokenServerId != m_serverId )
+        {
+            debug_printf( "connect token server id mismatch\n" );
+            m_counters[SERVER_COUNTER_CONNECT_TOKEN_SERVER_ID_MISMATCH]++;
+            return;
+        }
+
+        uint64_t timestamp = (uint64_t) ::time( NULL );
+
+        if ( packet.connectTokenExpireTimestamp <= timestamp )
+        {
+            debug_printf( "connect token expired\n" );
+            m_counters[SERVER_COUNTER_CONNECT_TOKEN_EXPIRED]++;
+            return;
+        }
+
+        if ( !m_handshakeRateLimiter.Admit( address, GetTime() ) )
+        {
+            debug_printf( "connection request rate limited\n" );
+            m_counters[SERVER_COUNTER_CONNECTION_REQUEST_RATE_LIMITED]++;
+            return;
+        }
+
+        uint8_t additionalData[ConnectTokenAdditionalDataBytes];
+        GenerateConnectTokenAdditionalData( packet.connectTokenProtocolId, packet.connectTokenExpireTimestamp, packet.connectTokenServerId, additionalData );
+
         ConnectToken connectToken;
-        if ( !DecryptConnectToken( packet.connectTokenData, connectToken, NULL, 0, packet.connectTokenNonce, m_privateKey ) )
+        if ( !DecryptConnectToken( packet.connectTokenData, connectToken, additionalData, ConnectTokenAdditionalDataBytes, packet.connectTokenNonce, m_privateKey ) )
         {
             debug_printf( "failed to decrypt connection token\n" );
             m_counters[SERVER_COUNTER_CONNECT_TOKEN_FAILED_TO_DECRYPT]++;
             return;
         }
 
+        if ( connectToken.protocolId != packet.connectTokenProtocolId || connectToken.expiryTimestamp != packet.connectTokenExpireTimestamp || connectToken.serverId != packet.connectTokenServerId )
+        {
+            debug_printf( "connect token does not match its additional data\n" );
+            m_counters[SERVER_COUNTER_CONNECT_TOKEN_FAILED_TO_DECRYPT]++;
+            return;
+        }
+
         bool serverAddressInConnectTokenWhiteList = false;
 
         for ( int i = 0; i < connectToken.numServerAddresses; ++i )
@@ -1889,15 +2746,6 @@ namespace yojimbo
             return;
         }
 
-        uint64_t timestamp = (uint64_t) ::time( NULL );
-
-        if ( connectToken.expiryTimestamp <= timestamp )
-        {
-            debug_printf( "connect token expired\n" );
-            m_counters[SERVER_COUNTER_CONNECT_TOKEN_EXPIRED]++;
-            return;
-        }
-
         if ( !FindConnectTokenEntry( packet.connectTokenData ) )
         {
             if ( !m_transport->AddEncryptionMapping( address, connectToken.serverToClientKey, connectToken.clientToServerKey ) )
@@ -1915,11 +2763,7 @@ namespace yojimbo
         {
             debug_printf( "server is full\n" );
             m_counters[SERVER_COUNTER_CONNECTION_DENIED_SERVER_IS_FULL]++;
-            ConnectionDeniedPacket * connectionDeniedPacket = (ConnectionDeniedPacket*) m_transport->CreatePacket( CLIENT_SERVER_PACKET_CONNECTION_DENIED );
-            if ( connectionDeniedPacket )
-            {
-                SendPacket( address, connectionDeniedPacket );
-            }
+            SendConnectionDenied( address );
             return;
         }
 
@@ -1938,16 +2782,15 @@ namespace yojimbo
             return;
         }
 
-        ConnectionChallengePacket * connectionChallengePacket = (ConnectionChallengePacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_CONNECTION_CHALLENGE );
-        if ( !connectionChallengePacket )
+        if ( !m_challengePacket )
         {
             debug_printf( "null connection challenge packet\n" );
             return;
         }
 
-        memcpy( connectionChallengePacket->challengeTokenNonce, (uint8_t*) &m_challengeTokenNonce, NonceBytes );
+        memcpy( m_challengePacket->challengeTokenNonce, (uint8_t*) &m_challengeTokenNonce, NonceBytes );
 
-        if ( !EncryptChallengeToken( challengeToken, connectionChallengePacket->challengeTokenData, NULL, 0, connectionChallengePacket->challengeTokenNonce, m_privateKey ) )
+        if ( !EncryptChallengeToken( challengeToken, m_challengePacket->challengeTokenData, NULL, 0, m_challengePacket->challengeTokenNonce, m_privateKey ) )
         {
             debug_printf( "failed to encrypt challenge token\n" );
             m_counters[SERVER_COUNTER_CHALLENGE_TOKEN_FAILED_TO_ENCRYPT]++;
@@ -1956,7 +2799,9 @@ namespace yojimbo
 
         m_counters[SERVER_COUNTER_CHALLENGE_PACKETS_SENT]++;
 
-        SendPacket( address, connectionChallengePacket );
+        m_transport->SendPacketImmediate( address, m_challengePacket, ++m_globalSequence );
+
+        OnPacketSent( CLIENT_SERVER_PACKET_CONNECTION_CHALLENGE, address, true );
     }
 
     void Server::ProcessConnectionResponse( const ConnectionResponsePacket & packet, const Address & address )
@@ -1970,6 +2815,13 @@ namespace yojimbo
 
         m_counters[SERVER_COUNTER_CHALLENGE_RESPONSE_PACKETS_RECEIVED]++;
 
+        if ( !m_handshakeRateLimiter.Admit( address, time ) )
+        {
+            debug_printf( "challenge response rate limited\n" );
+            m_counters[SERVER_COUNTER_CHALLENGE_RESPONSE_RATE_LIMITED]++;
+            return;
+        }
+
         ChallengeToken challengeToken;
         if ( !DecryptChallengeToken( packet.challengeTokenData, challengeToken, NULL, 0, packet.challengeTokenNonce, m_privateKey ) )
         {
@@ -1984,7 +2836,7 @@ namespace yojimbo
             assert( existingClientIndex >= 0 );
             assert( existingClientIndex < m_maxClients );
 
-            if ( m_clientData[existingClientIndex].lastPacketSendTime + ConnectionConfirmSendRate < time )
+            if ( m_clientLastPacketSendTime[existingClientIndex] + ConnectionConfirmSendRate < time )
             {
                 ConnectionHeartBeatPacket * connectionHeartBeatPacket = CreateHeartBeatPacket( existingClientIndex );
 
@@ -2002,11 +2854,7 @@ namespace yojimbo
         if ( m_numConnectedClients == m_maxClients )
         {
             m_counters[SERVER_COUNTER_CONNECTION_DENIED_SERVER_IS_FULL]++;
-            ConnectionDeniedPacket * connectionDeniedPacket = (ConnectionDeniedPacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_CONNECTION_DENIED );
-            if ( connectionDeniedPacket )
-            {
-                SendPacket( address, connectionDeniedPacket );
-            }
+            SendConnectionDenied( address );
             return;
         }
 
@@ -2035,9 +2883,9 @@ namespace yojimbo
 
         const double time = GetTime();
         
-        m_clientData[clientIndex].lastPacketReceiveTime = time;
+        m_clientLastPacketReceiveTime[clientIndex] = time;
 
-        m_clientData[clientIndex].fullyConnected = true;
+        m_clientFullyConnected[clientIndex] = true;
     }
 
     void Server::ProcessConnectionDisconnect( const ConnectionDisconnectPacket & /*packet*/, const Address & address )
@@ -2067,11 +2915,7 @@ namespace yojimbo
         if ( m_numConnectedClients == m_maxClients )
         {
             m_counters[SERVER_COUNTER_CONNECTION_DENIED_SERVER_IS_FULL]++;
-            ConnectionDeniedPacket * connectionDeniedPacket = (ConnectionDeniedPacket*) CreateGlobalPacket( CLIENT_SERVER_PACKET_CONNECTION_DENIED );
-            if ( connectionDeniedPacket )
-            {
-                SendPacket( address, connectionDeniedPacket );
-            }
+            SendConnectionDenied( address );
             return;
         }
 
@@ -2118,9 +2962,9 @@ namespace yojimbo
         if ( m_connection[clientIndex] )
             m_connection[clientIndex]->ProcessPacket( &packet );
 
-        m_clientData[clientIndex].lastPacketReceiveTime = GetTime();
+        m_clientLastPacketReceiveTime[clientIndex] = GetTime();
 
-        m_clientData[clientIndex].fullyConnected = true;
+        m_clientFullyConnected[clientIndex] = true;
     }
 
     void Server::ProcessPacket( Packet * packet, const Address & address, uint64_t sequence )
@@ -2164,12 +3008,12 @@ namespace yojimbo
         if ( clientIndex == -1 )
             return;
 
-        m_clientData[clientIndex].fullyConnected = true;
+        m_clientFullyConnected[clientIndex] = true;
 
         if ( !ProcessGamePacket( clientIndex, packet, sequence ) )
             return;
 
-        m_clientData[clientIndex].lastPacketReceiveTime = GetTime();
+        m_clientLastPacketReceiveTime[clientIndex] = GetTime();
     }
 
     ConnectionHeartBeatPacket * Server::CreateHeartBeatPacket( int clientIndex )
@@ -2179,6 +3023,7 @@ namespace yojimbo
         if ( packet )
         {
             packet->clientIndex = clientIndex;
+            packet->maxClients = m_maxClients;
         }
 
         return packet;
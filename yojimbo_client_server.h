@@ -31,17 +31,26 @@
 #include "yojimbo_transport.h"
 #include "yojimbo_encryption.h"
 #include "yojimbo_connection.h"
+#include "yojimbo_timer_wheel.h"
 #include "yojimbo_packet_processor.h"
 
 namespace yojimbo
 {
-    const int MaxClients = 64;
-    const int MaxConnectTokenEntries = MaxClients * 16;
+    const int MaxClients = 64;                                          // default client capacity for Server::Start. not a limit, pass a larger value to start to host more clients.
+    const int ConnectTokenEntriesPerClient = 16;
+    const int ConnectTokenEntriesPerBucket = 8;
     const int ConnectTokenBytes = 1024;
     const int ChallengeTokenBytes = 256;
+    const int ConnectTokenAdditionalDataBytes = 20;
     const int MaxServersPerConnectToken = 8;
     const int ConnectTokenExpirySeconds = 30;
     const int NumDisconnectPackets = 10;
+    const int HandshakeRateLimitDepth = 4;
+    const int HandshakeRateLimitWidth = 4096;
+    const int HandshakeRateLimitPerAddress = 32;
+    const int HandshakeRateLimitPerPrefix = 1024;
+    const float HandshakeRateLimitDecayTime = 1.0f;
+    const int HandshakeDecryptBudget = 16384;
     const float ConnectionRequestSendRate = 0.1f;
     const float ConnectionResponseSendRate = 0.1f;
     const float ConnectionConfirmSendRate = 0.1f;
@@ -49,6 +58,7 @@ namespace yojimbo
     const float ConnectionRequestTimeOut = 5.0f;
     const float ChallengeResponseTimeOut = 5.0f;
     const float ConnectionTimeOut = 10.0f;
+    const float ServerTimerResolution = 0.01f;
 #if YOJIMBO_INSECURE_CONNECT
     const float InsecureConnectSendRate = 0.1f;
     const float InsecureConnectTimeOut = 5.0f;
@@ -61,6 +71,8 @@ namespace yojimbo
         uint64_t clientId;                                                  // the unique client id. max one connection per-client id, per-server.
      
         uint64_t expiryTimestamp;                                           // timestamp the connect token expires (eg. ~10 seconds after token creation)
+
+        uint64_t serverId;                                                  // id of the server this token is for. lets servers that share an address and private key tell their tokens apart.
      
         int numServerAddresses;                                             // the number of server addresses in the connect token whitelist.
      
@@ -77,6 +89,7 @@ namespace yojimbo
             protocolId = 0;
             clientId = 0;
             expiryTimestamp = 0;
+            serverId = 0;
             numServerAddresses = 0;
             memset( clientToServerKey, 0, KeyBytes );
             memset( serverToClientKey, 0, KeyBytes );
@@ -90,6 +103,8 @@ namespace yojimbo
             serialize_uint64( stream, clientId );
             
             serialize_uint64( stream, expiryTimestamp );
+
+            serialize_uint64( stream, serverId );
             
             serialize_int( stream, numServerAddresses, 0, MaxServersPerConnectToken - 1 );
             
@@ -146,12 +161,14 @@ namespace yojimbo
         }
     };
 
-    void GenerateConnectToken( ConnectToken & token, uint64_t clientId, int numServerAddresses, const Address * serverAddresses, uint32_t protocolId );
+    void GenerateConnectToken( ConnectToken & token, uint64_t clientId, int numServerAddresses, const Address * serverAddresses, uint32_t protocolId, uint64_t serverId = 0 );
 
     bool EncryptConnectToken( const ConnectToken & token, uint8_t *encryptedMessage, const uint8_t *additional, int additionalLength, const uint8_t * nonce, const uint8_t * key );
 
     bool DecryptConnectToken( const uint8_t * encryptedMessage, ConnectToken & decryptedToken, const uint8_t * additional, int additionalLength, const uint8_t * nonce, const uint8_t * key );
 
+    void GenerateConnectTokenAdditionalData( uint32_t protocolId, uint64_t expiryTimestamp, uint64_t serverId, uint8_t * additionalData );
+
     bool WriteConnectTokenToJSON( const ConnectToken & connectToken, char * output, int outputSize );
 
     bool ReadConnectTokenFromJSON( const char * json, ConnectToken & connectToken );
@@ -164,17 +181,26 @@ namespace yojimbo
 
     struct ConnectionRequestPacket : public Packet
     {
+        uint32_t connectTokenProtocolId;                                    // protocol id of the connect token. cleartext, but bound to the token as additional data.
+        uint64_t connectTokenExpireTimestamp;                               // expiry timestamp of the connect token. cleartext, but bound to the token as additional data.
+        uint64_t connectTokenServerId;                                      // id of the server the connect token is for. cleartext, but bound to the token as additional data.
         uint8_t connectTokenData[ConnectTokenBytes];                        // encrypted connect token data generated by matchmaker
         uint8_t connectTokenNonce[NonceBytes];                              // nonce required to decrypt the connect token on the server
 
         ConnectionRequestPacket()
         {
+            connectTokenProtocolId = 0;
+            connectTokenExpireTimestamp = 0;
+            connectTokenServerId = 0;
             memset( connectTokenData, 0, sizeof( connectTokenData ) );
             memset( connectTokenNonce, 0, sizeof( connectTokenNonce ) );
         }
 
         template <typename Stream> bool Serialize( Stream & stream )
         {
+            serialize_uint32( stream, connectTokenProtocolId );
+            serialize_uint64( stream, connectTokenExpireTimestamp );
+            serialize_uint64( stream, connectTokenServerId );
             serialize_bytes( stream, connectTokenData, sizeof( connectTokenData ) );
             serialize_bytes( stream, connectTokenNonce, sizeof( connectTokenNonce ) );
             return true;
@@ -235,15 +261,29 @@ namespace yojimbo
     struct ConnectionHeartBeatPacket : public Packet
     {
         int clientIndex;
+        int maxClients;                                                       // capacity the server was started with. only used when writing, to size the client index.
 
         ConnectionHeartBeatPacket()
         {
             clientIndex = 0;
+            maxClients = 1;
         }
 
         template <typename Stream> bool Serialize( Stream & stream )
         { 
-            serialize_int( stream, clientIndex, 0, MaxClients - 1 );
+            // client capacity is a runtime setting on the server, so the client index is sent with its bit count in front
+
+            int clientIndexBits = 0;
+            if ( Stream::IsWriting )
+                clientIndexBits = maxClients > 1 ? bits_required( 0, maxClients - 1 ) : 0;
+
+            serialize_int( stream, clientIndexBits, 0, 31 );
+
+            if ( clientIndexBits > 0 )
+                serialize_bits( stream, clientIndex, clientIndexBits );
+            else if ( Stream::IsReading )
+                clientIndex = 0;
+
             return true; 
         }
 
@@ -328,10 +368,6 @@ namespace yojimbo
         uint64_t clientSalt;
 #endif // #if YOJIMBO_INSECURE_CONNECT
         double connectTime;
-        double lastPacketSendTime;
-        double lastHeartBeatSendTime;
-        double lastPacketReceiveTime;
-        bool fullyConnected;
 
         ServerClientData()
         {
@@ -340,10 +376,6 @@ namespace yojimbo
             clientSalt = 0;
 #endif // #if YOJIMBO_INSECURE_CONNECT
             connectTime = 0.0;
-            lastPacketSendTime = 0.0;
-            lastHeartBeatSendTime = 0.0;
-            lastPacketReceiveTime = 0.0;
-            fullyConnected = false;
         }
     };
 
@@ -360,6 +392,49 @@ namespace yojimbo
         }
     };
 
+    class HandshakeRateLimiter
+    {
+        // Fixed size count-min sketch of handshake packets admitted per-source. Counters are halved every decay period,
+        // so a source that stops sending is forgiven after a few seconds. Sources are counted both by address and by
+        // network prefix (/24 for IPv4, /64 for IPv6), so spraying packets from many ports or hosts on a subnet doesn't help.
+        // Admissions across all sources are capped by a decrypt budget per-second, and only admitted packets are counted,
+        // so a spray of spoofed sources can't fill the sketch and lock out real clients. It only sheds the excess.
+
+    public:
+
+        HandshakeRateLimiter();
+
+        void Reset( uint64_t seed, double time, int decryptBudget = HandshakeDecryptBudget );
+
+        bool Admit( const Address & address, double time );
+
+    protected:
+
+        void Decay( double time );
+
+        bool SpendBudget( double time );
+
+        void GetIndices( const uint8_t * key, int keyBytes, int * index ) const;
+
+        uint32_t Estimate( const int * index ) const;
+
+        void Add( const int * index );
+
+    private:
+
+        uint64_t m_seed;                                                    // random seed for hashing so attackers can't choose colliding sources
+
+        double m_decayTime;                                                 // time counters were last halved
+
+        double m_budgetTime;                                                // time the decrypt budget was last refilled
+
+        int m_decryptBudget;                                                // decrypts admitted per-second, across all sources.
+
+        double m_budget;                                                    // decrypts we can still admit right now. refills at the decrypt budget per-second.
+
+        uint16_t m_counters[HandshakeRateLimitDepth][HandshakeRateLimitWidth];  // saturating counters, one row per hash function
+    };
+
     struct ClientServerContext : public ConnectionContext {};
 
     enum ClientState
@@ -404,7 +479,9 @@ namespace yojimbo
                       const uint8_t * connectTokenData, 
                       const uint8_t * connectTokenNonce,
                       const uint8_t * clientToServerKey,
-                      const uint8_t * serverToClientKey );
+                      const uint8_t * serverToClientKey,
+                      uint64_t connectTokenExpireTimestamp,
+                      uint64_t connectTokenServerId = 0 );
 
         bool IsConnecting() const;
 
@@ -442,6 +519,8 @@ namespace yojimbo
 
         int GetClientIndex() const;
 
+        bool GetConnectionStats( ConnectionStats & stats ) const;
+
     protected:
 
         virtual void OnConnect( const Address & /*address*/ ) {}
@@ -460,7 +539,9 @@ namespace yojimbo
 
         virtual void OnConnectionPacketReceived( Connection * /*connection*/, uint16_t /*sequence*/ ) {}
 
-        virtual void OnConnectionFragmentReceived( Connection * /*connection*/, uint16_t /*messageId*/, uint16_t /*fragmentId*/, int /*fragmentBytes*/, int /*channelId*/ ) {}
+        virtual void OnConnectionFragmentReceived( Connection * /*connection*/, uint16_t /*messageId*/, int /*fragmentId*/, int /*fragmentBytes*/, int /*channelId*/ ) {}
+
+        virtual void OnConnectionBlockData( Connection * /*connection*/, uint16_t /*messageId*/, BlockMessage * /*blockMessage*/, const uint8_t * /*data*/, int /*offset*/, int /*bytes*/, bool /*complete*/, int /*channelId*/ ) {}
 
         virtual bool ProcessGamePacket( Packet * /*packet*/, uint64_t /*sequence*/ ) { return false; }
 
@@ -546,6 +627,10 @@ namespace yojimbo
 
         uint8_t m_connectTokenNonce[NonceBytes];                            // nonce required to send to server so it can decrypt connect token
 
+        uint64_t m_connectTokenExpireTimestamp;                             // connect token expiry timestamp. sent in the clear so the server can reject stale tokens without decrypting them.
+
+        uint64_t m_connectTokenServerId;                                    // id of the server the connect token is for. sent in the clear so requests can be routed without decrypting them.
+
         uint8_t m_challengeTokenData[ChallengeTokenBytes];                  // encrypted challenge token data for challenge response packet
 
         uint8_t m_challengeTokenNonce[NonceBytes];                          // nonce required to send to server so it can decrypt challenge token
@@ -560,6 +645,9 @@ namespace yojimbo
     enum ServerCounters
     {
         SERVER_COUNTER_CONNECTION_REQUEST_PACKETS_RECEIVED,
+        SERVER_COUNTER_CONNECT_TOKEN_PROTOCOL_ID_MISMATCH,
+        SERVER_COUNTER_CONNECT_TOKEN_SERVER_ID_MISMATCH,
+        SERVER_COUNTER_CONNECTION_REQUEST_RATE_LIMITED,
         SERVER_COUNTER_CONNECT_TOKEN_FAILED_TO_DECRYPT,
         SERVER_COUNTER_CONNECT_TOKEN_SERVER_ADDRESS_NOT_IN_WHITELIST,
         SERVER_COUNTER_CONNECT_TOKEN_CLIENT_ID_IS_ZERO,
@@ -573,6 +661,7 @@ namespace yojimbo
         SERVER_COUNTER_CHALLENGE_TOKEN_FAILED_TO_DECRYPT,
         SERVER_COUNTER_CHALLENGE_PACKETS_SENT,
         SERVER_COUNTER_CHALLENGE_RESPONSE_PACKETS_RECEIVED,
+        SERVER_COUNTER_CHALLENGE_RESPONSE_RATE_LIMITED,
         SERVER_COUNTER_CLIENT_CONNECTS,
         SERVER_COUNTER_CLIENT_DISCONNECTS,
         SERVER_COUNTER_CLIENT_CLEAN_DISCONNECTS,
@@ -583,6 +672,8 @@ namespace yojimbo
         SERVER_COUNTER_CLIENT_PACKET_FACTORY_ERRORS,
         SERVER_COUNTER_GLOBAL_PACKET_FACTORY_ERRORS,
         SERVER_COUNTER_GLOBAL_STREAM_ALLOCATOR_ERRORS,
+        SERVER_COUNTER_BROADCAST_MESSAGES_SENT,
+        SERVER_COUNTER_BROADCAST_MESSAGE_CAPTURE_FAILURES,
         SERVER_COUNTER_NUM_COUNTERS
     };
 
@@ -593,7 +684,7 @@ namespace yojimbo
         SERVER_FLAG_ALLOW_INSECURE_CONNECT = (1<<2)
     };
 
-    class Server : public ConnectionListener
+    class Server : public ConnectionListener, public TransportListener
     {
     public:
 
@@ -607,7 +698,9 @@ namespace yojimbo
         
         void SetServerAddress( const Address & address );
 
-        void Start( int maxClients = MaxClients );
+        void SetServerId( uint64_t serverId );
+
+        bool Start( int maxClients = MaxClients );
 
         void Stop();
 
@@ -627,6 +720,12 @@ namespace yojimbo
 
         MessageFactory & GetMessageFactory( int clientIndex );
 
+        Message * CreateGlobalMessage( int type );
+
+        void ReleaseGlobalMessage( Message * message );
+
+        void BroadcastMessage( Message * message, const uint64_t * clientMask = NULL );
+
         Packet * CreateGlobalPacket( int type );
 
         Packet * CreateClientPacket( int clientIndex, int type );
@@ -641,6 +740,8 @@ namespace yojimbo
 
         void SetFlags( uint64_t flags );
 
+        void SetWorkerPool( WorkerPool * workerPool );
+
         // accessors
 
         bool IsRunning() const;
@@ -659,6 +760,8 @@ namespace yojimbo
 
         const Address & GetClientAddress( int clientIndex ) const;
 
+        bool GetConnectionStats( int clientIndex, ConnectionStats & stats ) const;
+
         uint64_t GetCounter( int index ) const;
 
         double GetTime() const;
@@ -689,7 +792,9 @@ namespace yojimbo
 
         virtual void OnConnectionPacketReceived( Connection * /*connection*/, uint16_t /*sequence*/ ) {}
 
-        virtual void OnConnectionFragmentReceived( Connection * /*connection*/, uint16_t /*messageId*/, uint16_t /*fragmentId*/, int /*fragmentBytes*/, int /*channelId*/ ) {}
+        virtual void OnConnectionFragmentReceived( Connection * /*connection*/, uint16_t /*messageId*/, int /*fragmentId*/, int /*fragmentBytes*/, int /*channelId*/ ) {}
+
+        virtual void OnConnectionBlockData( Connection * /*connection*/, uint16_t /*messageId*/, BlockMessage * /*blockMessage*/, const uint8_t * /*data*/, int /*offset*/, int /*bytes*/, bool /*complete*/, int /*channelId*/ ) {}
 
         virtual bool ProcessGamePacket( int /*clientIndex*/, Packet * /*packet*/, uint64_t /*sequence*/ ) { return false; }
 
@@ -709,12 +814,16 @@ namespace yojimbo
 
         virtual void ResetClientState( int clientIndex );
 
+        void ReleaseSharedMessages();
+
         int FindFreeClientIndex() const;
 
         int FindExistingClientIndex( const Address & address ) const;
 
         int FindExistingClientIndex( const Address & address, uint64_t clientId ) const;
 
+        ConnectTokenEntry * GetConnectTokenBucket( const uint8_t * mac );
+
         bool FindConnectTokenEntry( const uint8_t * mac );
         
         bool FindOrAddConnectTokenEntry( const Address & address, const uint8_t * mac );
@@ -729,6 +838,10 @@ namespace yojimbo
 
         void SendPacketToConnectedClient( int clientIndex, Packet * packet, bool immediate = false );
 
+        void SendConnectionDenied( const Address & address );
+
+        bool ProcessRawPacket( const Address & from, const uint8_t * packetData, int packetBytes );
+
         void ProcessConnectionRequest( const ConnectionRequestPacket & packet, const Address & address );
 
         void ProcessConnectionResponse( const ConnectionResponsePacket & packet, const Address & address );
@@ -747,29 +860,53 @@ namespace yojimbo
 
         ConnectionHeartBeatPacket * CreateHeartBeatPacket( int clientIndex );
 
+        void GenerateClientPackets( int workerIndex );
+
+        static void GenerateClientPacketsWorker( void * data, int workerIndex );
+
+        void ReceivePacketsParallel();
+
+        void ProcessReceiveEntries();
+
+        void ProcessClientPackets( int workerIndex );
+
+        static void ProcessClientPacketsWorker( void * data, int workerIndex );
+
         Transport * GetTransport() { return m_transport; }
 
     private:
 
         void Defaults();
 
+        void FreeClientArrays();
+
+        struct ReceiveEntry
+        {
+            ConnectionPacket * packet;                                      // connection packet received from a connected client.
+            int clientIndex;                                                // client slot the packet belongs to. the slot decides which worker processes it.
+        };
+
         ConnectionConfig m_connectionConfig;                                // connection configuration.
 
         Allocator * m_allocator;                                            // allocator used for creating connections per-client.
 
         Allocator * m_globalStreamAllocator;                                // stream allocator for global packets. eg. packets not corresponding to an active client slot.
 
-        Allocator * m_clientStreamAllocator[MaxClients];                    // stream allocator for per-client packets. this allocator is used once a connection is established.
+        Allocator ** m_clientStreamAllocator;                               // stream allocator for per-client packets. this allocator is used once a connection is established.
 
         Transport * m_transport;                                            // transport interface for sending and receiving packets.
 
         ClientServerContext * m_globalContext;                              // global serialization context for client/server packets. used prior to connection.
 
-        ClientServerContext * m_clientContext[MaxClients];                  // per-client serialization context for client/server packets once connected.
+        ClientServerContext ** m_clientContext;                             // per-client serialization context for client/server packets once connected.
+
+        MessageFactory ** m_clientMessageFactory;                           // message factory for creating and destroying messages. per-client and optional.
+
+        PacketFactory ** m_clientPacketFactory;                             // packet factory for creating and destroying packets. per-client. required.
 
-        MessageFactory * m_clientMessageFactory[MaxClients];                // message factory for creating and destroying messages. per-client and optional.
+        MessageFactory * m_globalMessageFactory;                            // message factory for broadcast messages. created with client index -1.
 
-        PacketFactory * m_clientPacketFactory[MaxClients];                  // packet factory for creating and destroying packets. per-client. required.
+        SharedMessage * m_sharedMessages;                                   // list of broadcast messages still queued on client connections. the server holds one reference to each.
 
         uint8_t m_privateKey[KeyBytes];                                     // private key used for encrypting and decrypting tokens.
 
@@ -783,25 +920,61 @@ namespace yojimbo
 
         int m_numConnectedClients;                                          // number of connected clients
         
-        bool m_clientConnected[MaxClients];                                 // true if client n is connected
+        bool * m_clientConnected;                                           // true if client n is connected
         
-        uint64_t m_clientId[MaxClients];                                    // array of client id values per-client
+        uint64_t * m_clientId;                                              // array of client id values per-client
 
         Address m_serverAddress;                                            // the external IP address of this server (what clients will be sending packets to)
 
+        uint64_t m_serverId;                                                // only connect tokens generated for this server id are accepted. 0 by default.
+
         uint64_t m_globalSequence;                                          // global sequence number for packets sent not corresponding to any particular connected client.
 
-        uint64_t m_clientSequence[MaxClients];                              // per-client sequence number for packets sent
+        uint64_t * m_clientSequence;                                        // per-client sequence number for packets sent
 
-        Address m_clientAddress[MaxClients];                                // array of client address values per-client
+        Address * m_clientAddress;                                          // array of client address values per-client
         
-        ServerClientData m_clientData[MaxClients];                          // heavier weight data per-client, eg. not for fast lookup
+        ServerClientData * m_clientData;                                    // heavier weight data per-client, eg. not for fast lookup
+
+        double * m_clientLastPacketSendTime;                                // time we last sent a packet to client n. hot per-tick data is kept in flat arrays, not in client data.
+
+        double * m_clientLastHeartBeatSendTime;                             // time we last sent a heartbeat packet to client n.
+
+        double * m_clientLastPacketReceiveTime;                             // time we last received a packet from client n (used for timeouts).
+
+        bool * m_clientFullyConnected;                                      // true once client n has sent us a packet after the handshake.
+
+        int * m_activeClients;                                              // dense list of connected client indices. first m_numConnectedClients entries are valid.
+
+        int * m_activeClientSlot;                                           // position of client n in the active list, or -1 if not connected. used to swap remove on disconnect.
+
+        TimerWheel * m_timeOutTimers;                                       // per-client time out deadlines. never later than the real deadline, which is checked again when the timer fires.
+
+        TimerWheel * m_heartBeatTimers;                                     // per-client heartbeat deadlines. never later than the real deadline, which is checked again when the timer fires.
 
         bool m_allocateConnections;                                         // true if we should allocate connection objects in start.
 
-        Connection * m_connection[MaxClients];                              // per-client connection. allocated and freed in start/stop according to max clients.
+        Connection ** m_connection;                                         // per-client connection. allocated and freed in start/stop according to max clients.
+
+        ConnectionPacket ** m_clientConnectionPacket;                       // per-client connection packet generated by workers, waiting to be sent in client order.
+
+        WorkerPool * m_workerPool;                                          // optional worker pool. when set, connection packets are generated and processed for clients in parallel.
+
+        int m_receiveBatchSize;                                             // maximum number of connection packets processed per worker pool run.
+
+        int m_numReceiveEntries;                                            // number of connection packets in the current receive batch.
+
+        ReceiveEntry * m_receiveEntries;                                    // connection packets in the current receive batch, in arrival order.
+
+        int m_numConnectTokenEntries;                                       // number of connect token entries. scales with max clients.
+
+        ConnectTokenEntry * m_connectTokenEntries;                          // connect token entries hashed by mac into buckets of ConnectTokenEntriesPerBucket. used to avoid replay attacks of the same connect token for different addresses.
+
+        HandshakeRateLimiter m_handshakeRateLimiter;                        // bounds how many connect and challenge tokens each source can make us decrypt.
+
+        ConnectionChallengePacket * m_challengePacket;                      // preallocated in start. connection requests are answered with this packet so they never allocate.
 
-        ConnectTokenEntry m_connectTokenEntries[MaxConnectTokenEntries];    // array of connect tokens entries. used to avoid replay attacks of the same connect token for different addresses.
+        ConnectionDeniedPacket * m_deniedPacket;                            // preallocated in start. sent in response to connection requests when the server is full.
 
         uint64_t m_counters[SERVER_COUNTER_NUM_COUNTERS];
 
@@ -135,6 +135,25 @@ namespace yojimbo
 #endif // #ifdef __GNUC__
     }
 
+    inline int popcount64( uint64_t x )
+    {
+#ifdef __GNUC__
+        return __builtin_popcountll( x );
+#else // #ifdef __GNUC__
+        return popcount( uint32_t( x & 0xFFFFFFFF ) ) + popcount( uint32_t( x >> 32 ) );
+#endif // #ifdef __GNUC__
+    }
+
+    inline int trailing_zeros64( uint64_t x )
+    {
+        assert( x != 0 );
+#ifdef __GNUC__
+        return __builtin_ctzll( x );
+#else // #ifdef __GNUC__
+        return popcount64( ( x & ( ~x + 1 ) ) - 1 );
+#endif // #ifdef __GNUC__
+    }
+
 #ifdef __GNUC__
 
     inline int bits_required( uint32_t min, uint32_t max )
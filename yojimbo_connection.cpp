@@ -134,7 +134,171 @@ namespace yojimbo
         return Serialize( stream );
     }
 
-    Connection::Connection( Allocator & allocator, PacketFactory & packetFactory, MessageFactory & messageFactory, const ConnectionConfig & config ) : m_config( config )
+    static const double CongestionMaxBurstTime = 0.1;                   // seconds worth of send rate the budget may bank while idle
+    static const double CongestionMinEpochTime = 0.1;                   // minimum length of an evaluation epoch. otherwise epochs last one smoothed rtt.
+    static const double CongestionLossThreshold = 0.05;                 // fraction of packets lost in an epoch that is treated as congestion
+    static const double CongestionQueueDelayThreshold = 0.025;          // minimum rtt increase over the baseline that is treated as queueing delay
+    static const double CongestionDecreaseFactor = 0.7;                 // multiplicative decrease applied on congestion
+
+    static const double RTTAlpha = 0.125;                               // exponential smoothing factor for rtt, per RFC 6298
+    static const double RTTBeta = 0.25;                                 // exponential smoothing factor for rtt variance, per RFC 6298
+    static const float PacketLossSmoothingFactor = 0.01f;               // exponential smoothing factor for rolling packet loss percentage. roughly the last hundred packets.
+
+    CongestionController::CongestionController( const ConnectionConfig & config )
+    {
+        m_minSendRate = config.minBandwidth * 1000.0;
+        m_maxSendRate = config.maxBandwidth * 1000.0;
+        m_maxPacketBits = config.maxPacketSize * 8.0;
+
+        assert( m_minSendRate > 0.0 );
+        assert( m_maxSendRate >= m_minSendRate );
+
+        m_time = 0.0;
+
+        Reset();
+    }
+
+    void CongestionController::Reset()
+    {
+        m_sendRate = m_minSendRate;
+        m_budget = m_maxPacketBits;
+        m_smoothedRTT = 0.0;
+        m_minRTT = 0.0;
+        m_slowStart = true;
+        m_epochStartTime = m_time;
+        m_epochSentBits = 0.0;
+        m_epochAcked = 0;
+        m_epochLost = 0;
+    }
+
+    void CongestionController::AdvanceTime( double time )
+    {
+        const double deltaTime = time - m_time;
+
+        m_time = time;
+
+        if ( deltaTime > 0.0 )
+        {
+            // IMPORTANT: the budget may always bank at least one full size packet, otherwise a message 
+            // larger than a burst at the current send rate would never fit and the channel would stall.
+
+            const double maxBudget = max( m_sendRate * CongestionMaxBurstTime, m_maxPacketBits );
+
+            m_budget = min( m_budget + m_sendRate * deltaTime, maxBudget );
+        }
+
+        const double epochTime = max( m_smoothedRTT, CongestionMinEpochTime );
+
+        if ( m_time - m_epochStartTime >= epochTime )
+            EndEpoch();
+    }
+
+    int CongestionController::GetAvailableBits() const
+    {
+        return m_budget > 0.0 ? (int) min( m_budget, m_maxPacketBits ) : 0;
+    }
+
+    void CongestionController::OnPacketSent( int packetBits )
+    {
+        m_budget -= packetBits;
+        m_epochSentBits += packetBits;
+    }
+
+    void CongestionController::OnPacketAcked( double smoothedRTT, double minRTT )
+    {
+        // rtt is estimated once, by the connection. we just keep its latest smoothed and minimum rtt.
+
+        m_epochAcked++;
+
+        m_smoothedRTT = smoothedRTT;
+        m_minRTT = minRTT;
+    }
+
+    void CongestionController::OnPacketLost()
+    {
+        m_epochLost++;
+    }
+
+    void CongestionController::EndEpoch()
+    {
+        const double epochTime = m_time - m_epochStartTime;
+
+        const int epochPackets = m_epochAcked + m_epochLost;
+
+        const bool lossCongestion = epochPackets > 0 && m_epochLost > CongestionLossThreshold * epochPackets;
+
+        const bool delayCongestion = m_smoothedRTT > 0.0 && m_smoothedRTT - m_minRTT > max( m_minRTT, CongestionQueueDelayThreshold );
+
+        if ( lossCongestion || delayCongestion )
+        {
+            m_sendRate *= CongestionDecreaseFactor;
+            m_slowStart = false;
+        }
+        else if ( m_epochSentBits >= 0.5 * m_sendRate * epochTime )
+        {
+            // only grow the send rate when the budget is actually being used. an idle connection proves nothing about the path.
+
+            if ( m_slowStart )
+                m_sendRate *= 2.0;
+            else
+                m_sendRate += m_maxPacketBits / epochTime;
+        }
+
+        m_sendRate = clamp( m_sendRate, m_minSendRate, m_maxSendRate );
+
+        m_epochStartTime = m_time;
+        m_epochSentBits = 0.0;
+        m_epochAcked = 0;
+        m_epochLost = 0;
+    }
+
+    static bool channel_goes_first( const ConnectionConfig & config, const double * channelPriority, int channelId, int otherChannelId )
+    {
+        const bool latencySensitive = config.channelConfig[channelId].latencySensitive;
+        const bool otherLatencySensitive = config.channelConfig[otherChannelId].latencySensitive;
+
+        if ( latencySensitive != otherLatencySensitive )
+            return latencySensitive;
+
+        if ( latencySensitive )
+            return false;
+
+        return channelPriority[channelId] > channelPriority[otherChannelId];
+    }
+
+    static void sort_channels_by_priority( const ConnectionConfig & config, const double * channelPriority, int * channelOrder )
+    {
+        // latency sensitive channels first in channel order, then weighted channels by the bandwidth they are owed. 
+        // stable insertion sort, since there are only a handful of channels.
+
+        for ( int channelId = 0; channelId < config.numChannels; ++channelId )
+        {
+            int j = channelId;
+
+            while ( j > 0 && channel_goes_first( config, channelPriority, channelId, channelOrder[j-1] ) )
+            {
+                channelOrder[j] = channelOrder[j-1];
+                j--;
+            }
+
+            channelOrder[j] = channelId;
+        }
+    }
+
+    static bool later_channel_has_data( const ConnectionConfig & config, const bool * channelHasData, const int * channelOrder, int index )
+    {
+        for ( int i = index + 1; i < config.numChannels; ++i )
+        {
+            const int channelId = channelOrder[i];
+
+            if ( channelHasData[channelId] && !config.channelConfig[channelId].latencySensitive )
+                return true;
+        }
+
+        return false;
+    }
+
+    Connection::Connection( Allocator & allocator, PacketFactory & packetFactory, MessageFactory & messageFactory, const ConnectionConfig & config ) : m_config( config ), m_congestionController( config )
     {
         assert( ( 65536 % config.slidingWindowSize ) == 0 );
 
@@ -150,6 +314,8 @@ namespace yojimbo
 
         m_clientIndex = 0;
 
+        m_time = 0.0;
+
         memset( m_channel, 0, sizeof( m_channel ) );
 
         assert( m_config.numChannels >= 1 );
@@ -163,10 +329,18 @@ namespace yojimbo
                     m_channel[channelId] = YOJIMBO_NEW( *m_allocator, ReliableOrderedChannel, *m_allocator, messageFactory, m_config.channelConfig[channelId], channelId ); 
                     break;
 
+                case CHANNEL_TYPE_RELIABLE_UNORDERED: 
+                    m_channel[channelId] = YOJIMBO_NEW( *m_allocator, ReliableUnorderedChannel, *m_allocator, messageFactory, m_config.channelConfig[channelId], channelId ); 
+                    break;
+
                 case CHANNEL_TYPE_UNRELIABLE_UNORDERED: 
                     m_channel[channelId] = YOJIMBO_NEW( *m_allocator, UnreliableUnorderedChannel, *m_allocator, messageFactory, m_config.channelConfig[channelId], channelId ); 
                     break;
 
+                case CHANNEL_TYPE_UNRELIABLE_SEQUENCED: 
+                    m_channel[channelId] = YOJIMBO_NEW( *m_allocator, UnreliableSequencedChannel, *m_allocator, messageFactory, m_config.channelConfig[channelId], channelId ); 
+                    break;
+
                 default: 
                     assert( !"unknown channel type" );
             }
@@ -174,6 +348,14 @@ namespace yojimbo
             m_channel[channelId]->SetListener( this );
         }
 
+        m_totalChannelPriority = 0.0;
+
+        for ( int channelId = 0; channelId < m_config.numChannels; ++channelId )
+        {
+            assert( m_config.channelConfig[channelId].priority > 0.0f );
+            m_totalChannelPriority += m_config.channelConfig[channelId].priority;
+        }
+
         m_sentPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<ConnectionSentPacketData>, *m_allocator, m_config.slidingWindowSize );
         
         m_receivedPackets = YOJIMBO_NEW( *m_allocator, SequenceBuffer<ConnectionReceivedPacketData>, *m_allocator, m_config.slidingWindowSize );
@@ -202,6 +384,20 @@ namespace yojimbo
         m_sentPackets->Reset();
         m_receivedPackets->Reset();
 
+        m_lossSequence = 0;
+
+        memset( m_channelPriority, 0, sizeof( m_channelPriority ) );
+
+        for ( int channelId = 0; channelId < MaxChannels; ++channelId )
+            m_channelHasData[channelId] = true;
+
+        m_rtt = 0.0;
+        m_rttVariance = 0.0;
+        m_minRTT = 0.0;
+        m_packetLoss = 0.0f;
+
+        m_congestionController.Reset();
+
         memset( m_counters, 0, sizeof( m_counters ) );
     }
 
@@ -252,13 +448,50 @@ namespace yojimbo
         memset( channelHasData, 0, sizeof( channelHasData ) );
         ChannelPacketData channelData[MaxChannels];
 
-        int availableBits = m_config.maxPacketSize * 8;
+        // each packet, every channel is owed its weighted share of the channel data in a full packet. channels are serviced
+        // in order of what they are owed and pay for the bits they use, so over time bandwidth is shared in proportion to
+        // priority. while a channel later in the order has data, a weighted channel may only use what it is owed, and the
+        // bits it leaves over go to the channels after it, so saturated channels share packets instead of taking turns.
 
-        availableBits -= ConservativeConnectionPacketHeaderEstimate;
+        const double packetQuantum = m_config.maxPacketSize * 8 - ConservativeConnectionPacketHeaderEstimate;
 
         for ( int channelId = 0; channelId < m_config.numChannels; ++channelId )
+            m_channelPriority[channelId] = min( m_channelPriority[channelId] + packetQuantum * m_config.channelConfig[channelId].priority / m_totalChannelPriority, packetQuantum );
+
+        int channelOrder[MaxChannels];
+
+        sort_channels_by_priority( m_config, m_channelPriority, channelOrder );
+
+        const int maxPacketBits = m_config.enableCongestionControl ? m_congestionController.GetAvailableBits() : m_config.maxPacketSize * 8;
+
+        int availableBits = maxPacketBits - ConservativeConnectionPacketHeaderEstimate;
+
+        for ( int i = 0; i < m_config.numChannels; ++i )
         {
-            int packetDataBits = m_channel[channelId]->GetPacketData( channelData[channelId], packet->sequence, availableBits );
+            // IMPORTANT: channels only add data that fits in the available bits, so don't ask them for data once the budget is spent.
+
+            if ( availableBits - ConservativeChannelHeaderEstimate <= 0 )
+                break;
+
+            const int channelId = channelOrder[i];
+
+            int channelBits = availableBits;
+
+            if ( !m_config.channelConfig[channelId].latencySensitive && later_channel_has_data( m_config, m_channelHasData, channelOrder, i ) )
+            {
+                channelBits = min( availableBits, (int) m_channelPriority[channelId] - ConservativeChannelHeaderEstimate );
+
+                if ( channelBits <= 0 )
+                    continue;
+            }
+
+            int packetDataBits = m_channel[channelId]->GetPacketData( channelData[channelId], packet->sequence, channelBits );
+
+            // a channel that adds nothing when offered everything it is owed has nothing to send. if it was only offered
+            // leftovers it may just have a message too big for them, so keep reserving bits for it.
+
+            if ( packetDataBits > 0 || channelBits >= (int) m_channelPriority[channelId] - ConservativeChannelHeaderEstimate )
+                m_channelHasData[channelId] = packetDataBits > 0;
 
             if ( packetDataBits > 0 )
             {
@@ -266,12 +499,17 @@ namespace yojimbo
 
                 availableBits -= packetDataBits;
 
+                m_channelPriority[channelId] = max( m_channelPriority[channelId] - ( ConservativeChannelHeaderEstimate + packetDataBits ), -packetQuantum );
+
                 channelHasData[channelId] = true;
 
                 numChannelsWithData++;
             }
         }
 
+        if ( m_config.enableCongestionControl )
+            m_congestionController.OnPacketSent( maxPacketBits - availableBits );
+
         if ( numChannelsWithData > 0 )
         {
             if ( !packet->AllocateChannelData( *m_messageFactory, numChannelsWithData ) )
@@ -328,6 +566,10 @@ namespace yojimbo
 
     void Connection::AdvanceTime( double time )
     {
+        m_time = time;
+
+        m_congestionController.AdvanceTime( time );
+
         for ( int i = 0; i < m_config.numChannels; ++i )
         {
             m_channel[i]->AdvanceTime( time );
@@ -342,6 +584,14 @@ namespace yojimbo
         }
     }
     
+    void Connection::SetContext( void * context )
+    {
+        // the serialization context packets from this connection are written with. channels that serialize messages ahead of time need it.
+
+        for ( int i = 0; i < m_config.numChannels; ++i )
+            m_channel[i]->SetContext( context );
+    }
+
     uint64_t Connection::GetCounter( int index ) const
     {
         assert( index >= 0 );
@@ -349,6 +599,17 @@ namespace yojimbo
         return m_counters[index];
     }
 
+    void Connection::GetStats( ConnectionStats & stats ) const
+    {
+        stats.rtt = m_rtt;
+        stats.rttVariance = m_rttVariance;
+        stats.packetLoss = m_packetLoss;
+        stats.sendBandwidth = m_config.enableCongestionControl ? float( m_congestionController.GetSendRate() / 1000.0 ) : 0.0f;
+        stats.numPacketsSent = m_counters[CONNECTION_COUNTER_PACKETS_GENERATED];
+        stats.numPacketsAcked = m_counters[CONNECTION_COUNTER_PACKETS_ACKED];
+        stats.numPacketsLost = m_counters[CONNECTION_COUNTER_PACKETS_LOST];
+    }
+
     ConnectionError Connection::GetError() const
     {
         return m_error;
@@ -362,6 +623,7 @@ namespace yojimbo
 
         if ( entry )
         {
+            entry->time = m_time;
             entry->acked = 0;
         }
     }
@@ -382,10 +644,24 @@ namespace yojimbo
             }
             ack_bits >>= 1;
         }
+
+        DetectLostPackets( ack );
     }
 
     void Connection::PacketAcked( uint16_t sequence )
     {
+        ConnectionSentPacketData * packetData = m_sentPackets->Find( sequence );
+
+        assert( packetData );
+
+        const double rtt = m_time - packetData->time;
+
+        UpdateRTT( rtt );
+
+        m_packetLoss += ( 0.0f - m_packetLoss ) * PacketLossSmoothingFactor;
+
+        m_congestionController.OnPacketAcked( m_rtt, m_minRTT );
+
         OnPacketAcked( sequence );
 
         for ( int channelId = 0; channelId < m_config.numChannels; ++channelId )
@@ -394,11 +670,64 @@ namespace yojimbo
         m_counters[CONNECTION_COUNTER_PACKETS_ACKED]++;
     }
 
-    void Connection::OnChannelFragmentReceived( class Channel * channel, uint16_t messageId, uint16_t fragmentId, int fragmentBytes )
+    void Connection::DetectLostPackets( uint16_t ack )
+    {
+        // a sent packet that slides out of the 32 packet ack window without being acked will never be acked. count it as lost.
+
+        const uint16_t oldestAckableSequence = ack - 31;
+
+        const uint16_t sendSequence = m_sentPackets->GetSequence();
+
+        while ( m_lossSequence != sendSequence && sequence_less_than( m_lossSequence, oldestAckableSequence ) )
+        {
+            ConnectionSentPacketData * packetData = m_sentPackets->Find( m_lossSequence );
+
+            if ( packetData && !packetData->acked )
+            {
+                m_packetLoss += ( 100.0f - m_packetLoss ) * PacketLossSmoothingFactor;
+
+                m_congestionController.OnPacketLost();
+
+                m_counters[CONNECTION_COUNTER_PACKETS_LOST]++;
+            }
+
+            m_lossSequence++;
+        }
+    }
+
+    void Connection::UpdateRTT( double rtt )
+    {
+        if ( m_rtt == 0.0 && m_rttVariance == 0.0 )
+        {
+            m_rtt = rtt;
+            m_rttVariance = rtt / 2;
+            m_minRTT = rtt;
+        }
+        else
+        {
+            const double deviation = rtt > m_rtt ? rtt - m_rtt : m_rtt - rtt;
+            m_rttVariance += ( deviation - m_rttVariance ) * RTTBeta;
+            m_rtt += ( rtt - m_rtt ) * RTTAlpha;
+            m_minRTT = min( m_minRTT, rtt );
+        }
+
+        for ( int channelId = 0; channelId < m_config.numChannels; ++channelId )
+            m_channel[channelId]->UpdateRTT( m_rtt, m_rttVariance );
+    }
+
+    void Connection::OnChannelFragmentReceived( class Channel * channel, uint16_t messageId, int fragmentId, int fragmentBytes )
     {
         if ( m_listener )
         {
             m_listener->OnConnectionFragmentReceived( this, messageId, fragmentId, fragmentBytes, channel->GetChannelId() );
         }
     }
+
+    void Connection::OnChannelBlockData( class Channel * channel, uint16_t messageId, BlockMessage * blockMessage, const uint8_t * data, int offset, int bytes, bool complete )
+    {
+        if ( m_listener )
+        {
+            m_listener->OnConnectionBlockData( this, messageId, blockMessage, data, offset, bytes, complete, channel->GetChannelId() );
+        }
+    }
 }
@@ -38,6 +38,9 @@ namespace yojimbo
         int slidingWindowSize;                                  // sliding window size for packet ack system (# of packets)
         int connectionPacketType;                               // connection packet type (so you may override it)
         int numChannels;                                        // number of channels: [1,MaxChannels]
+        bool enableCongestionControl;                           // if true, the bits sent per-packet are shaped by a send rate adapted to measured rtt and packet loss
+        float minBandwidth;                                     // lower bound on the congestion controlled send rate (kilobits per-second)
+        float maxBandwidth;                                     // upper bound on the congestion controlled send rate (kilobits per-second)
         ChannelConfig channelConfig[MaxChannels];
 
         ConnectionConfig()
@@ -46,6 +49,9 @@ namespace yojimbo
             slidingWindowSize = 1024;
             numChannels = 1;
             connectionPacketType = 0;
+            enableCongestionControl = false;
+            minBandwidth = 64.0f;
+            maxBandwidth = 8 * 1024.0f;
         }
     };
 
@@ -105,6 +111,7 @@ namespace yojimbo
         CONNECTION_COUNTER_PACKETS_GENERATED,                   // number of packets generated
         CONNECTION_COUNTER_PACKETS_PROCESSED,                   // number of packets processed
         CONNECTION_COUNTER_PACKETS_ACKED,                       // number of packets acked
+        CONNECTION_COUNTER_PACKETS_LOST,                        // number of packets that fell out of the ack window without being acked
         CONNECTION_COUNTER_NUM_COUNTERS
     };
 
@@ -127,11 +134,93 @@ namespace yojimbo
 
         virtual void OnConnectionPacketReceived( class Connection * /*connection*/, uint16_t /*sequence*/ ) {}
 
-        virtual void OnConnectionFragmentReceived( class Connection * /*connection*/, uint16_t /*messageId*/, uint16_t /*fragmentId*/, int /*fragmentBytes*/, int /*channelId*/ ) {}
+        virtual void OnConnectionFragmentReceived( class Connection * /*connection*/, uint16_t /*messageId*/, int /*fragmentId*/, int /*fragmentBytes*/, int /*channelId*/ ) {}
+
+        virtual void OnConnectionBlockData( class Connection * /*connection*/, uint16_t /*messageId*/, BlockMessage * /*blockMessage*/, const uint8_t * /*data*/, int /*offset*/, int /*bytes*/, bool /*complete*/, int /*channelId*/ ) {}
+    };
+
+    struct ConnectionStats
+    {
+        double rtt;                                             // smoothed round trip time (seconds)
+        double rttVariance;                                     // smoothed mean deviation of round trip time, aka. jitter (seconds)
+        float packetLoss;                                       // rolling percentage of sent packets that were lost [0,100]
+        float sendBandwidth;                                    // congestion controlled send rate (kilobits per-second). zero if congestion control is disabled.
+        uint64_t numPacketsSent;                                // number of connection packets sent
+        uint64_t numPacketsAcked;                               // number of connection packets acked
+        uint64_t numPacketsLost;                                // number of connection packets lost
+
+        ConnectionStats()
+        {
+            rtt = 0.0;
+            rttVariance = 0.0;
+            packetLoss = 0.0f;
+            sendBandwidth = 0.0f;
+            numPacketsSent = 0;
+            numPacketsAcked = 0;
+            numPacketsLost = 0;
+        }
+    };
+
+    class CongestionController
+    {
+    public:
+
+        CongestionController( const ConnectionConfig & config );
+
+        void Reset();
+
+        void AdvanceTime( double time );
+
+        int GetAvailableBits() const;
+
+        void OnPacketSent( int packetBits );
+
+        void OnPacketAcked( double smoothedRTT, double minRTT );
+
+        void OnPacketLost();
+
+        double GetSendRate() const { return m_sendRate; }
+
+        double GetSmoothedRTT() const { return m_smoothedRTT; }
+
+        bool InSlowStart() const { return m_slowStart; }
+
+    protected:
+
+        void EndEpoch();
+
+    private:
+
+        double m_minSendRate;                                                           // lower bound on the send rate (bits per-second)
+
+        double m_maxSendRate;                                                           // upper bound on the send rate (bits per-second)
+
+        double m_maxPacketBits;                                                         // bits in a maximum size packet. the budget may always fill up to at least this much.
+
+        double m_time;                                                                  // current time. set by AdvanceTime.
+
+        double m_sendRate;                                                              // current send rate (bits per-second)
+
+        double m_budget;                                                                // bits that may be sent right now. refilled at the send rate, goes negative when a packet overdraws it.
+
+        double m_smoothedRTT;                                                           // smoothed rtt of the connection as of the last ack (seconds). zero until the first packet is acked.
+
+        double m_minRTT;                                                                // minimum rtt of the connection as of the last ack. used as the baseline for detecting queueing delay.
+
+        bool m_slowStart;                                                               // true while doubling the send rate each epoch, until the first congestion signal.
+
+        double m_epochStartTime;                                                        // time the current evaluation epoch started
+
+        double m_epochSentBits;                                                         // bits sent during the current epoch
+
+        int m_epochAcked;                                                               // packets acked during the current epoch
+
+        int m_epochLost;                                                                // packets lost during the current epoch
     };
 
     struct ConnectionSentPacketData 
     { 
+        double time;
         uint8_t acked;
     };
 
@@ -163,12 +252,18 @@ namespace yojimbo
 
         void SetListener( ConnectionListener * listener ) { m_listener = listener; }
 
+        void SetContext( void * context );
+
         void SetClientIndex( int clientIndex ) { m_clientIndex = clientIndex; }
 
         int GetClientIndex() const { return m_clientIndex; }
 
         uint64_t GetCounter( int index ) const;
 
+        void GetStats( ConnectionStats & stats ) const;
+
+        const CongestionController & GetCongestionController() const { return m_congestionController; }
+
     protected:
 
         virtual void OnPacketSent( uint16_t /*sequence*/ ) {}
@@ -185,7 +280,13 @@ namespace yojimbo
 
         void PacketAcked( uint16_t sequence );
 
-        void OnChannelFragmentReceived( class Channel * channel, uint16_t messageId, uint16_t fragmentId, int fragmentBytes );
+        void DetectLostPackets( uint16_t ack );
+
+        void UpdateRTT( double rtt );
+
+        void OnChannelFragmentReceived( class Channel * channel, uint16_t messageId, int fragmentId, int fragmentBytes );
+
+        void OnChannelBlockData( class Channel * channel, uint16_t messageId, BlockMessage * blockMessage, const uint8_t * data, int offset, int bytes, bool complete );
 
     private:
 
@@ -195,8 +296,28 @@ namespace yojimbo
 
         int m_clientIndex;                                                              // optional client index for server client connections. 0 by default.
 
+        double m_time;                                                                  // current connection time. set by AdvanceTime.
+
+        uint16_t m_lossSequence;                                                        // oldest sent packet sequence not yet checked for loss
+
+        double m_rtt;                                                                   // smoothed round trip time. zero until the first packet is acked.
+
+        double m_rttVariance;                                                           // smoothed mean deviation of round trip time
+
+        double m_minRTT;                                                                // minimum round trip time seen. zero until the first packet is acked.
+
+        float m_packetLoss;                                                             // rolling packet loss percentage
+
+        CongestionController m_congestionController;                                    // adapts the per-connection send rate. only consulted if config.enableCongestionControl is true.
+
         Channel * m_channel[MaxChannels];                                               // message channels. see config.numChannels for size of this array.
 
+        double m_channelPriority[MaxChannels];                                          // priority accumulator per-channel. bits of packet bandwidth each channel is owed.
+
+        double m_totalChannelPriority;                                                  // sum of channel priority weights. see config.channelConfig[].priority
+
+        bool m_channelHasData[MaxChannels];                                             // true if the channel added data the last time it was asked. assumed true until it shows otherwise.
+
         Allocator * m_allocator;                                                        // allocator for allocations matching life cycle of object
 
         PacketFactory * m_packetFactory;                                                // packet factory for creating and destroying connection packets
@@ -246,6 +246,9 @@ namespace yojimbo
         if ( !exists_and_is_string( doc, "connectTokenNonce" ) )
             return false;
 
+        if ( !exists_and_is_string( doc, "connectTokenExpireTimestamp" ) )
+            return false;
+
         if ( !exists_and_is_array( doc, "serverAddresses" ) )
             return false;
 
@@ -266,6 +269,13 @@ namespace yojimbo
 
         memcpy( &matchResponse.connectTokenNonce, &connectTokenNonce, 8 );
 
+        matchResponse.connectTokenExpireTimestamp = (uint64_t) atoll( doc["connectTokenExpireTimestamp"].GetString() );
+
+        matchResponse.connectTokenServerId = 0;
+
+        if ( exists_and_is_string( doc, "connectTokenServerId" ) )
+            matchResponse.connectTokenServerId = (uint64_t) atoll( doc["connectTokenServerId"].GetString() );
+
         matchResponse.numServerAddresses = 0;
 
         const Value & serverAddresses = doc["serverAddresses"];
@@ -44,6 +44,8 @@ namespace yojimbo
         MatchResponse()
         {
             numServerAddresses = 0;
+            connectTokenExpireTimestamp = 0;
+            connectTokenServerId = 0;
             memset( connectTokenData, 0, sizeof( connectTokenData ) );
             memset( connectTokenNonce, 0, sizeof( connectTokenNonce ) );
             memset( clientToServerKey, 0, sizeof( clientToServerKey ) );
@@ -54,6 +56,8 @@ namespace yojimbo
         Address serverAddresses[MaxServersPerConnectToken];
         uint8_t connectTokenData[ConnectTokenBytes];
         uint8_t connectTokenNonce[NonceBytes];
+        uint64_t connectTokenExpireTimestamp;
+        uint64_t connectTokenServerId;
         uint8_t clientToServerKey[KeyBytes];
         uint8_t serverToClientKey[KeyBytes];
     };
@@ -0,0 +1,162 @@
+/*
+    Yojimbo Client/Server Network Library.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_message.h"
+#include "yojimbo_common.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    static bool write_shared_message_variant( Message & message, void * context, uint8_t * buffer, int bytes, int offset, int & bits )
+    {
+        WriteStream stream( buffer, bytes );
+
+        stream.SetContext( context );
+
+        if ( offset > 0 )
+            stream.SerializeBits( 0, offset );
+
+        if ( !message.SerializeInternal( stream ) )
+            return false;
+
+        stream.Flush();
+
+        bits = stream.GetBitsProcessed() - offset;
+
+        return true;
+    }
+
+    SharedMessage::SharedMessage( Allocator & allocator ) : Message( 0, 1 )
+    {
+        m_allocator = &allocator;
+        m_measuredBits = 0;
+        m_numVariants = 0;
+        m_variantBytes = 0;
+        memset( m_variantBits, 0, sizeof( m_variantBits ) );
+        m_data = NULL;
+        m_next = NULL;
+    }
+
+    SharedMessage::~SharedMessage()
+    {
+        assert( m_allocator );
+        m_allocator->Free( m_data );
+        m_data = NULL;
+    }
+
+    bool SharedMessage::Capture( Message & message, void * context )
+    {
+        assert( !m_data );
+        assert( !message.IsBlockMessage() );
+        assert( !message.IsSharedMessage() );
+
+        SetType( message.GetType() );
+
+        MeasureStream measureStream;
+
+        measureStream.SetContext( context );
+
+        if ( !message.SerializeInternal( measureStream ) )
+            return false;
+
+        m_measuredBits = measureStream.GetBitsProcessed();
+
+        // leave room for up to 7 leading offset bits. the bit writer needs a whole number of words.
+
+        m_variantBytes = ( ( m_measuredBits + 7 + 31 ) / 32 ) * 4;
+
+        // write at bit offsets 0 and 1. if the sizes match the message never aligns, so one copy of its bits is valid at any offset.
+        // otherwise padding depends on where the message lands in the packet, so keep a copy for each bit offset mod 8.
+
+        m_data = (uint8_t*) m_allocator->Allocate( m_variantBytes * 2 );
+        if ( !m_data )
+            return false;
+
+        if ( !write_shared_message_variant( message, context, m_data, m_variantBytes, 0, m_variantBits[0] ) )
+            return false;
+
+        if ( !write_shared_message_variant( message, context, m_data + m_variantBytes, m_variantBytes, 1, m_variantBits[1] ) )
+            return false;
+
+        if ( m_variantBits[0] == m_variantBits[1] )
+        {
+            m_numVariants = 1;
+            return true;
+        }
+
+        m_allocator->Free( m_data );
+
+        m_data = (uint8_t*) m_allocator->Allocate( m_variantBytes * 8 );
+        if ( !m_data )
+            return false;
+
+        for ( int offset = 0; offset < 8; ++offset )
+        {
+            if ( !write_shared_message_variant( message, context, m_data + offset * m_variantBytes, m_variantBytes, offset, m_variantBits[offset] ) )
+                return false;
+        }
+
+        m_numVariants = 8;
+
+        return true;
+    }
+
+    bool SharedMessage::SerializeInternal( ReadStream & /*stream*/ )
+    {
+        // shared messages are only ever sent. the receiver reads the original message type from the packet.
+
+        assert( !"shared messages cannot be read" );
+
+        return false;
+    }
+
+    bool SharedMessage::SerializeInternal( WriteStream & stream )
+    {
+        assert( m_data );
+        assert( m_numVariants > 0 );
+
+        const int offset = ( m_numVariants == 1 ) ? 0 : ( stream.GetBitsProcessed() % 8 );
+
+        // the variant was written starting at the same bit offset, so its bits splice straight into the packet
+
+        return stream.SerializeBitStream( (const uint32_t*) ( m_data + offset * m_variantBytes ), offset, m_variantBits[offset] );
+    }
+
+    bool SharedMessage::SerializeInternal( MeasureStream & stream )
+    {
+        int bitsRemaining = m_measuredBits;
+
+        while ( bitsRemaining > 0 )
+        {
+            const int bits = min( bitsRemaining, 32 );
+
+            stream.SerializeBits( 0, bits );
+
+            bitsRemaining -= bits;
+        }
+
+        return true;
+    }
+}
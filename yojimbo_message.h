@@ -29,6 +29,7 @@
 #include "yojimbo_serialize.h"
 #include "yojimbo_allocator.h"
 #include "yojimbo_bit_array.h"
+#include "yojimbo_thread.h"
 
 #if YOJIMBO_DEBUG_MESSAGE_LEAKS
 #include <map>
@@ -40,7 +41,7 @@ namespace yojimbo
     {
     public:
 
-        Message( int blockMessage = 0 ) : m_refCount(1), m_id(0), m_type(0), m_blockMessage( blockMessage ) {}
+        Message( int blockMessage = 0, int sharedMessage = 0 ) : m_refCount(1), m_id(0), m_type(0), m_sharedMessage( sharedMessage ), m_blockMessage( blockMessage ) {}
 
         void AssignId( uint16_t id ) { m_id = id; }
 
@@ -48,10 +49,12 @@ namespace yojimbo
 
         int GetType() const { return m_type; }
 
-        int GetRefCount() { return m_refCount; }
+        int GetRefCount() const { return m_refCount; }
 
         bool IsBlockMessage() const { return m_blockMessage; }
 
+        bool IsSharedMessage() const { return m_sharedMessage; }
+
         virtual bool SerializeInternal( ReadStream & stream ) = 0;
 
         virtual bool SerializeInternal( WriteStream & stream ) = 0;
@@ -62,9 +65,11 @@ namespace yojimbo
 
         void SetType( int type ) { m_type = type; }
 
-        void AddRef() { m_refCount++; }
+        // shared messages are referenced by many connections that may be updated on different worker threads, so their refcount is atomic
+
+        void AddRef() { if ( m_sharedMessage ) atomic_add( &m_refCount, 1 ); else m_refCount++; }
 
-        void Release() { assert( m_refCount > 0 ); m_refCount--; }
+        int Release() { assert( m_refCount > 0 ); return m_sharedMessage ? atomic_add( &m_refCount, -1 ) : --m_refCount; }
 
         virtual ~Message()
         {
@@ -79,9 +84,10 @@ namespace yojimbo
         
         const Message & operator = ( const Message & other );
 
-        int m_refCount;
+        volatile int m_refCount;
         uint32_t m_id : 16;
-        uint32_t m_type : 15;       
+        uint32_t m_type : 14;       
+        uint32_t m_sharedMessage : 1;
         uint32_t m_blockMessage : 1;
     };
 
@@ -146,6 +152,56 @@ namespace yojimbo
         int m_blockSize;
     };
 
+    class SharedMessage : public Message
+    {
+        // Immutable message payload serialized once and referenced by many connections, eg. for a server broadcast.
+        // Writing splices the captured bits into the packet, so the wire format matches the original message exactly.
+
+    public:
+
+        SharedMessage( Allocator & allocator );
+
+        ~SharedMessage();
+
+        bool Capture( Message & message, void * context );
+
+        Allocator & GetAllocator() { return *m_allocator; }
+
+        int GetMeasuredBits() const { return m_measuredBits; }
+
+        int GetNumVariants() const { return m_numVariants; }
+
+        SharedMessage * GetNext() const { return m_next; }
+
+        void SetNext( SharedMessage * next ) { m_next = next; }
+
+        bool SerializeInternal( ReadStream & stream );
+
+        bool SerializeInternal( WriteStream & stream );
+
+        bool SerializeInternal( MeasureStream & stream );
+
+    private:
+
+        Allocator * m_allocator;                                        // allocator used to create the shared message and its data.
+
+        int m_measuredBits;                                             // conservative size in bits, as measured from the original message.
+
+        int m_numVariants;                                              // 1 if the payload bits are the same at any bit offset, otherwise one per offset mod 8.
+
+        int m_variantBytes;                                             // size of each variant buffer in bytes.
+
+        int m_variantBits[8];                                           // number of payload bits in each variant, excluding the leading offset bits.
+
+        uint8_t * m_data;                                               // variant buffers, each m_variantBytes long.
+
+        SharedMessage * m_next;                                         // next shared message in the owner's list.
+
+        SharedMessage( const SharedMessage & other );
+
+        const SharedMessage & operator = ( const SharedMessage & other );
+    };
+
     enum MessageFactoryError
     {
         MESSAGE_FACTORY_ERROR_NONE,
@@ -167,6 +223,8 @@ namespace yojimbo
 
         MessageFactory( Allocator & allocator, int numTypes )
         {
+            assert( numTypes <= ( 1 << 14 ) );          // message type is stored in a 14 bit field
+
             m_allocator = &allocator;
             m_numTypes = numTypes;
             m_error = MESSAGE_FACTORY_ERROR_NONE;
@@ -230,9 +288,20 @@ namespace yojimbo
             if ( !message )
                 return;
 
-            message->Release();
-            
-            if ( message->GetRefCount() == 0 )
+            if ( message->Release() != 0 )
+                return;
+
+            if ( message->IsSharedMessage() )
+            {
+                // shared messages are not tracked by any one factory. they are freed with the allocator they were created with.
+
+                SharedMessage * sharedMessage = (SharedMessage*) message;
+
+                Allocator & allocator = sharedMessage->GetAllocator();
+
+                YOJIMBO_DELETE( allocator, SharedMessage, sharedMessage );
+            }
+            else
             {
                 #if YOJIMBO_DEBUG_MESSAGE_LEAKS
                 assert( allocated_messages.find( message ) != allocated_messages.end() );
@@ -282,15 +351,27 @@ namespace yojimbo
         uint32_t block : 1;
     };
 
+    struct MessageResendEntry
+    {
+        double timeSent;                             // time the message was sent. stale if this no longer matches the send queue entry.
+        uint16_t messageId;
+    };
+
+    struct MessageSentFragmentEntry
+    {
+        uint16_t messageId;                          // message id of the block this fragment belongs to
+        uint32_t fragmentId;
+    };
+
     struct MessageSentPacketEntry
     {
         double timeSent;
         uint16_t * messageIds;
+        MessageSentFragmentEntry * fragments;        // block fragments in this packet. valid only when sending block.
         uint32_t numMessageIds : 16;                 // number of messages in this packet
+        uint32_t numFragments : 14;                  // number of block fragments in this packet
         uint32_t acked : 1;                          // 1 if this sent packet has been acked
-        uint64_t block : 1;                          // 1 if this sent packet contains a block fragment
-        uint64_t blockMessageId : 16;                // block id. valid only when sending block.
-        uint64_t blockFragmentId : 16;               // fragment id. valid only when sending block.
+        uint32_t block : 1;                          // 1 if this sent packet contains block fragments
     };
 
     struct MessageReceiveQueueEntry
@@ -300,30 +381,58 @@ namespace yojimbo
 
     struct SendBlockData
     {
-        SendBlockData( Allocator & allocator, int maxBlockSize, int maxFragmentsPerBlock )
+        SendBlockData( Allocator & allocator )
         {
             m_allocator = &allocator;
-            ackedFragment = YOJIMBO_NEW( allocator, BitArray, allocator, maxFragmentsPerBlock );
-            fragmentSendTime = (double*) allocator.Allocate( sizeof( double) * maxFragmentsPerBlock );
-            blockData = (uint8_t*) allocator.Allocate( maxBlockSize );            
-            assert( ackedFragment && blockData && fragmentSendTime );
+            ackedFragment = NULL;
+            fragmentSendTime = NULL;
             Reset();
         }
 
         ~SendBlockData()
+        {
+            FreeFragments();
+        }
+
+        bool AllocateFragments( int numFragments )
+        {
+            // fragment state is sized to the block being sent and only held while it is active, so a large max block size costs nothing up front.
+
+            assert( numFragments > 0 );
+            assert( !ackedFragment );
+            assert( !fragmentSendTime );
+
+            ackedFragment = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, numFragments );
+            fragmentSendTime = (double*) m_allocator->Allocate( sizeof( double ) * numFragments );
+
+            if ( ackedFragment && fragmentSendTime )
+                return true;
+
+            FreeFragments();
+
+            return false;
+        }
+
+        void FreeFragments()
         {
             YOJIMBO_DELETE( *m_allocator, BitArray, ackedFragment );
-            m_allocator->Free( blockData );
-            m_allocator->Free( fragmentSendTime );
-            fragmentSendTime = NULL;
-            blockData = NULL;
+
+            if ( fragmentSendTime )
+            {
+                m_allocator->Free( fragmentSendTime );
+                fragmentSendTime = NULL;
+            }
         }
 
         void Reset()
         {
+            FreeFragments();
             active = false;
             numFragments = 0;
             numAckedFragments = 0;
+            numSentFragments = 0;
+            nextFragmentId = 0;
+            firstUnackedFragmentId = 0;
             blockMessageId = 0;
             blockSize = 0;
         }
@@ -331,11 +440,13 @@ namespace yojimbo
         bool active;                                                    // true if we are currently sending a block
         int numFragments;                                               // number of fragments in the current block being sent
         int numAckedFragments;                                          // number of acked fragments in current block being sent
+        int numSentFragments;                                           // number of fragments sent at least once. first sends are in order, so these are fragments [0,numSentFragments). the next block can start once all have been sent.
+        int nextFragmentId;                                             // fragment to consider first when resending. sent but unacked fragments are resent round robin from here.
+        int firstUnackedFragmentId;                                     // every fragment before this one has been acked. the fragment window starts here.
         int blockSize;                                                  // send block size in bytes
         uint16_t blockMessageId;                                        // the message id of the block being sent
-        BitArray * ackedFragment;                                       // has fragment n been received?
-        double * fragmentSendTime;                                      // time fragment was last sent in seconds.
-        uint8_t * blockData;                                            // block data storage as it is received.
+        BitArray * ackedFragment;                                       // has fragment n been received? NULL unless a block is being sent.
+        double * fragmentSendTime;                                      // time fragment was last sent in seconds. NULL unless a block is being sent.
 
     private:
 
@@ -348,28 +459,48 @@ namespace yojimbo
 
     struct ReceiveBlockData
     {
-        ReceiveBlockData( Allocator & allocator, int maxBlockSize, int maxFragmentsPerBlock )
+        ReceiveBlockData( Allocator & allocator )
         {
             m_allocator = &allocator;
-            receivedFragment = YOJIMBO_NEW( allocator, BitArray, allocator, maxFragmentsPerBlock );
-            blockData = (uint8_t*) allocator.Allocate( maxBlockSize );            
-            assert( receivedFragment && blockData );
+            receivedFragment = NULL;
+            blockData = NULL;
             blockMessage = NULL;
             Reset();
         }
 
         ~ReceiveBlockData()
+        {
+            // IMPORTANT: the owner frees block data and releases the block message before this point. see ReliableOrderedChannel::Reset.
+            assert( !blockData );
+            assert( !blockMessage );
+            FreeFragments();
+        }
+
+        bool AllocateFragments( int numFragments )
+        {
+            // like block data, the received fragment bits are sized to the block and only held while it is being received.
+
+            assert( numFragments > 0 );
+            assert( !receivedFragment );
+
+            receivedFragment = YOJIMBO_NEW( *m_allocator, BitArray, *m_allocator, numFragments );
+
+            return receivedFragment != NULL;
+        }
+
+        void FreeFragments()
         {
             YOJIMBO_DELETE( *m_allocator, BitArray, receivedFragment );
-            m_allocator->Free( blockData );
-            blockData = NULL;
         }
 
         void Reset()
         {
+            FreeFragments();
             active = false;
             numFragments = 0;
             numReceivedFragments = 0;
+            numStreamedFragments = 0;
+            numBufferFragments = 0;
             messageId = 0;
             messageType = 0;
             blockSize = 0;
@@ -378,11 +509,13 @@ namespace yojimbo
         bool active;                                                    // true if we are currently receiving a block
         int numFragments;                                               // number of fragments in this block
         int numReceivedFragments;                                       // number of fragments received.
+        int numStreamedFragments;                                       // number of fragments at the start of the block passed to the channel listener so far. streamed blocks only.
+        int numBufferFragments;                                         // number of fragments block data has room for. fragment n is stored at slot n % numBufferFragments.
         uint16_t messageId;                                             // message id of block being currently received.
         int messageType;                                                // message type of the block being received.
         uint32_t blockSize;                                             // block size in bytes.
-        BitArray * receivedFragment;                                    // has fragment n been received?
-        uint8_t * blockData;                                            // block data for receive
+        BitArray * receivedFragment;                                    // has fragment n been received? NULL unless a block is being received.
+        uint8_t * blockData;                                            // block data for receive. allocated from the message factory when the block starts, and handed to the block message once complete. a ring of fragment window slots for streamed blocks.
         BlockMessage * blockMessage;                                    // block message (sent with fragment 0)
 
     private:
@@ -0,0 +1,589 @@
+/*
+    Yojimbo Client/Server Network Library.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "yojimbo_multiplexer.h"
+#include "yojimbo_client_server.h"
+#include <string.h>
+
+namespace yojimbo
+{
+    TransportMultiplexer::TransportMultiplexer( Transport & transport )
+    {
+        m_transport = &transport;
+        m_time = transport.GetTime();
+        m_numEndpoints = 0;
+        m_numRoutes = 0;
+        memset( m_endpoints, 0, sizeof( m_endpoints ) );
+        memset( m_routeEndpoint, 0, sizeof( m_routeEndpoint ) );
+        memset( m_routeLastAccessTime, 0, sizeof( m_routeLastAccessTime ) );
+        memset( m_counters, 0, sizeof( m_counters ) );
+        m_transport->SetListener( this );
+    }
+
+    TransportMultiplexer::~TransportMultiplexer()
+    {
+        // IMPORTANT: destroy every multiplexed transport before the multiplexer
+        assert( m_numEndpoints == 0 );
+
+        m_transport->SetListener( NULL );
+        m_transport = NULL;
+    }
+
+    void TransportMultiplexer::ReadPackets()
+    {
+        m_transport->ReadPackets();
+
+        while ( true )
+        {
+            Address from;
+            uint64_t sequence = 0;
+
+            Packet * packet = m_transport->ReceivePacket( from, &sequence );
+            if ( !packet )
+                break;
+
+            const int routeIndex = FindRoute( from );
+
+            if ( routeIndex == -1 )
+            {
+                m_counters[MULTIPLEXER_COUNTER_UNROUTED_PACKETS]++;
+                packet->Destroy();
+                continue;
+            }
+
+            if ( !m_routeEndpoint[routeIndex]->QueueReceivedPacket( from, packet, sequence ) )
+            {
+                m_counters[MULTIPLEXER_COUNTER_RECEIVE_QUEUE_OVERFLOW]++;
+                packet->Destroy();
+                continue;
+            }
+
+            m_counters[MULTIPLEXER_COUNTER_PACKETS_ROUTED]++;
+        }
+    }
+
+    void TransportMultiplexer::WritePackets()
+    {
+        for ( int i = 0; i < m_numEndpoints; ++i )
+            m_endpoints[i]->FlushSendQueue();
+
+        m_transport->WritePackets();
+    }
+
+    void TransportMultiplexer::AdvanceTime( double time )
+    {
+        m_time = time;
+        m_transport->AdvanceTime( time );
+    }
+
+    double TransportMultiplexer::GetTime() const
+    {
+        return m_time;
+    }
+
+    uint64_t TransportMultiplexer::GetCounter( int index ) const
+    {
+        assert( index >= 0 );
+        assert( index < MULTIPLEXER_COUNTER_NUM_COUNTERS );
+        return m_counters[index];
+    }
+
+    bool TransportMultiplexer::ProcessRawPacket( const Address & from, const uint8_t * packetData, int packetBytes )
+    {
+        const int routeIndex = FindRoute( from );
+
+        if ( routeIndex != -1 )
+        {
+            TransportListener * listener = m_routeEndpoint[routeIndex]->GetListener();
+
+            return listener ? listener->ProcessRawPacket( from, packetData, packetBytes ) : false;
+        }
+
+        // no server owns this address yet, so only a connection request can be taken. it goes to the one server named
+        // by its server id. the server that accepts the connect token adds an encryption mapping, which routes the address.
+
+        if ( packetData[0] != 0 )
+            return false;
+
+        PacketReadWriteInfo info;
+        info.protocolId = m_transport->GetProtocolId();
+        info.packetFactory = m_transport->GetPacketFactory();
+        info.streamAllocator = &GetDefaultAllocator();
+        info.prefixBytes = 1;
+
+        ConnectionRequestPacket packet;
+
+        int readError;
+
+        if ( !ReadPacketInPlace( info, packetData, packetBytes, CLIENT_SERVER_PACKET_CONNECTION_REQUEST, packet, &readError ) )
+            return readError == YOJIMBO_PROTOCOL_ERROR_SERIALIZE_PACKET_FAILED || readError == YOJIMBO_PROTOCOL_ERROR_SERIALIZE_CHECK_FAILED;
+
+        MultiplexedTransport * endpoint = FindEndpoint( packet.connectTokenServerId );
+
+        if ( !endpoint )
+        {
+            m_counters[MULTIPLEXER_COUNTER_UNKNOWN_SERVER_ID]++;
+            return true;
+        }
+
+        TransportListener * listener = endpoint->GetListener();
+
+        return listener ? listener->ProcessRawPacket( from, packetData, packetBytes ) : false;
+    }
+
+    bool TransportMultiplexer::AddEndpoint( MultiplexedTransport * endpoint )
+    {
+        assert( endpoint );
+
+        if ( m_numEndpoints == MaxMultiplexedTransports )
+            return false;
+
+        if ( FindEndpoint( endpoint->GetServerId() ) )
+            return false;
+
+        m_endpoints[m_numEndpoints++] = endpoint;
+
+        return true;
+    }
+
+    void TransportMultiplexer::RemoveEndpoint( MultiplexedTransport * endpoint )
+    {
+        assert( endpoint );
+
+        RemoveRoutes( endpoint );
+
+        for ( int i = 0; i < m_numEndpoints; ++i )
+        {
+            if ( m_endpoints[i] == endpoint )
+            {
+                m_endpoints[i] = m_endpoints[--m_numEndpoints];
+                m_endpoints[m_numEndpoints] = NULL;
+                return;
+            }
+        }
+    }
+
+    MultiplexedTransport * TransportMultiplexer::FindEndpoint( uint64_t serverId )
+    {
+        for ( int i = 0; i < m_numEndpoints; ++i )
+        {
+            if ( m_endpoints[i]->GetServerId() == serverId )
+                return m_endpoints[i];
+        }
+
+        return NULL;
+    }
+
+    int TransportMultiplexer::FindRoute( const Address & address )
+    {
+        for ( int i = 0; i < m_numRoutes; ++i )
+        {
+            if ( m_routeEndpoint[i] && m_routeAddress[i] == address )
+            {
+                if ( m_routeLastAccessTime[i] + DefaultEncryptionMappingTimeout < m_time )
+                {
+                    m_transport->RemoveContextMapping( m_routeAddress[i] );
+                    m_routeEndpoint[i] = NULL;
+                    return -1;
+                }
+
+                m_routeLastAccessTime[i] = m_time;
+
+                return i;
+            }
+        }
+
+        return -1;
+    }
+
+    bool TransportMultiplexer::AddRoute( const Address & address, MultiplexedTransport * endpoint )
+    {
+        assert( endpoint );
+
+        int freeIndex = -1;
+
+        for ( int i = 0; i < m_numRoutes; ++i )
+        {
+            if ( m_routeEndpoint[i] && m_routeAddress[i] == address )
+            {
+                m_routeEndpoint[i] = endpoint;
+                m_routeLastAccessTime[i] = m_time;
+                return true;
+            }
+
+            if ( freeIndex == -1 && ( !m_routeEndpoint[i] || m_routeLastAccessTime[i] + DefaultEncryptionMappingTimeout < m_time ) )
+                freeIndex = i;
+        }
+
+        if ( freeIndex == -1 )
+        {
+            if ( m_numRoutes == MaxEncryptionMappings )
+            {
+                m_counters[MULTIPLEXER_COUNTER_ROUTE_TABLE_FULL]++;
+                return false;
+            }
+
+            freeIndex = m_numRoutes++;
+        }
+        else if ( m_routeEndpoint[freeIndex] )
+        {
+            m_transport->RemoveContextMapping( m_routeAddress[freeIndex] );
+        }
+
+        m_routeAddress[freeIndex] = address;
+        m_routeEndpoint[freeIndex] = endpoint;
+        m_routeLastAccessTime[freeIndex] = m_time;
+
+        return true;
+    }
+
+    void TransportMultiplexer::RemoveRoute( const Address & address )
+    {
+        for ( int i = 0; i < m_numRoutes; ++i )
+        {
+            if ( m_routeEndpoint[i] && m_routeAddress[i] == address )
+            {
+                m_routeEndpoint[i] = NULL;
+                break;
+            }
+        }
+
+        while ( m_numRoutes > 0 && !m_routeEndpoint[m_numRoutes-1] )
+            m_numRoutes--;
+    }
+
+    void TransportMultiplexer::RemoveRoutes( MultiplexedTransport * endpoint )
+    {
+        for ( int i = 0; i < m_numRoutes; ++i )
+        {
+            if ( m_routeEndpoint[i] == endpoint )
+            {
+                m_transport->RemoveContextMapping( m_routeAddress[i] );
+                m_transport->RemoveEncryptionMapping( m_routeAddress[i] );
+                m_routeEndpoint[i] = NULL;
+            }
+        }
+
+        while ( m_numRoutes > 0 && !m_routeEndpoint[m_numRoutes-1] )
+            m_numRoutes--;
+    }
+
+    void TransportMultiplexer::RemoveContextMappings( MultiplexedTransport * endpoint )
+    {
+        for ( int i = 0; i < m_numRoutes; ++i )
+        {
+            if ( m_routeEndpoint[i] == endpoint )
+                m_transport->RemoveContextMapping( m_routeAddress[i] );
+        }
+    }
+
+    MultiplexedTransport::MultiplexedTransport( Allocator & allocator, TransportMultiplexer & multiplexer, uint64_t serverId, int sendQueueSize, int receiveQueueSize )
+        : m_sendQueue( allocator, sendQueueSize ), m_receiveQueue( allocator, receiveQueueSize )
+    {
+        m_multiplexer = &multiplexer;
+        m_transport = &multiplexer.GetTransport();
+        m_serverId = serverId;
+        m_listener = NULL;
+        m_streamAllocator = NULL;
+        m_context = NULL;
+
+        if ( !m_multiplexer->AddEndpoint( this ) )
+        {
+            debug_printf( "too many multiplexed transports, or server id already in use\n" );
+            assert( !"too many multiplexed transports, or server id already in use" );
+        }
+    }
+
+    MultiplexedTransport::~MultiplexedTransport()
+    {
+        ClearSendQueue();
+        ClearReceiveQueue();
+
+        m_multiplexer->RemoveEndpoint( this );
+
+        m_multiplexer = NULL;
+        m_transport = NULL;
+    }
+
+    void MultiplexedTransport::Reset()
+    {
+        ClearSendQueue();
+
+        ClearReceiveQueue();
+
+        m_multiplexer->RemoveRoutes( this );
+    }
+
+    Packet * MultiplexedTransport::CreatePacket( int type )
+    {
+        return m_transport->CreatePacket( type );
+    }
+
+    void MultiplexedTransport::SendPacket( const Address & address, Packet * packet, uint64_t sequence, bool immediate )
+    {
+        assert( packet );
+        assert( packet->IsValid() );
+        assert( address.IsValid() );
+
+        if ( immediate )
+        {
+            m_transport->SendPacket( address, packet, sequence, true );
+            return;
+        }
+
+        if ( m_sendQueue.IsFull() )
+        {
+            debug_printf( "multiplexed transport send queue overflow\n" );
+            m_multiplexer->m_counters[MULTIPLEXER_COUNTER_SEND_QUEUE_OVERFLOW]++;
+            packet->Destroy();
+            return;
+        }
+
+        PacketEntry entry;
+        entry.sequence = sequence;
+        entry.address = address;
+        entry.packet = packet;
+
+        m_sendQueue.Push( entry );
+    }
+
+    void MultiplexedTransport::SendPacketImmediate( const Address & address, Packet * packet, uint64_t sequence )
+    {
+        m_transport->SendPacketImmediate( address, packet, sequence );
+    }
+
+    Packet * MultiplexedTransport::ReceivePacket( Address & from, uint64_t * sequence )
+    {
+        if ( m_receiveQueue.IsEmpty() )
+            return NULL;
+
+        PacketEntry entry = m_receiveQueue.Pop();
+
+        assert( entry.packet );
+        assert( entry.address.IsValid() );
+
+        from = entry.address;
+
+        if ( sequence )
+            *sequence = entry.sequence;
+
+        return entry.packet;
+    }
+
+    int MultiplexedTransport::GetMaxPacketSize() const
+    {
+        return m_transport->GetMaxPacketSize();
+    }
+
+    void MultiplexedTransport::SetContext( void * context )
+    {
+        // the shared transport has its own global context. this one is given to addresses routed here, until the server maps them.
+
+        m_context = context;
+    }
+
+    void MultiplexedTransport::SetListener( TransportListener * listener )
+    {
+        m_listener = listener;
+    }
+
+    void MultiplexedTransport::SetWorkerPool( WorkerPool * workerPool )
+    {
+        // packets are read and written by the shared transport. set the worker pool on that instead.
+
+        assert( !workerPool );
+        (void) workerPool;
+    }
+
+    void MultiplexedTransport::SetStreamAllocator( Allocator & allocator )
+    {
+        m_streamAllocator = &allocator;
+    }
+
+    void MultiplexedTransport::EnablePacketEncryption()
+    {
+        m_transport->EnablePacketEncryption();
+    }
+
+    void MultiplexedTransport::DisableEncryptionForPacketType( int type )
+    {
+        m_transport->DisableEncryptionForPacketType( type );
+    }
+
+    bool MultiplexedTransport::IsEncryptedPacketType( int type ) const
+    {
+        return m_transport->IsEncryptedPacketType( type );
+    }
+
+    bool MultiplexedTransport::AddEncryptionMapping( const Address & address, const uint8_t * sendKey, const uint8_t * receiveKey )
+    {
+        if ( !m_transport->AddEncryptionMapping( address, sendKey, receiveKey ) )
+            return false;
+
+        if ( !m_multiplexer->AddRoute( address, this ) )
+        {
+            m_transport->RemoveEncryptionMapping( address );
+            return false;
+        }
+
+        // until the server adds its own context mapping, packets from the address are read with this server's global
+        // stream allocator and context, just as they would be on a transport of its own. the route removes it on expiry.
+
+        if ( m_streamAllocator && !m_transport->AddContextMapping( address, *m_streamAllocator, *m_transport->GetPacketFactory(), m_context ) )
+        {
+            m_multiplexer->RemoveRoute( address );
+            m_transport->RemoveEncryptionMapping( address );
+            return false;
+        }
+
+        return true;
+    }
+
+    bool MultiplexedTransport::RemoveEncryptionMapping( const Address & address )
+    {
+        m_transport->RemoveContextMapping( address );
+
+        m_multiplexer->RemoveRoute( address );
+
+        return m_transport->RemoveEncryptionMapping( address );
+    }
+
+    void MultiplexedTransport::ResetEncryptionMappings()
+    {
+        // only this endpoint's mappings. with no route left, its context mappings can't be reached either, so they go too.
+
+        m_multiplexer->RemoveRoutes( this );
+    }
+
+    bool MultiplexedTransport::AddContextMapping( const Address & address, Allocator & streamAllocator, PacketFactory & packetFactory, void * contextData )
+    {
+        if ( !m_transport->AddContextMapping( address, streamAllocator, packetFactory, contextData ) )
+            return false;
+
+        if ( !m_multiplexer->AddRoute( address, this ) )
+        {
+            m_transport->RemoveContextMapping( address );
+            return false;
+        }
+
+        return true;
+    }
+
+    bool MultiplexedTransport::RemoveContextMapping( const Address & address )
+    {
+        return m_transport->RemoveContextMapping( address );
+    }
+
+    void MultiplexedTransport::ResetContextMappings()
+    {
+        m_multiplexer->RemoveContextMappings( this );
+    }
+
+    double MultiplexedTransport::GetTime() const
+    {
+        return m_transport->GetTime();
+    }
+
+    uint64_t MultiplexedTransport::GetCounter( int index ) const
+    {
+        return m_transport->GetCounter( index );
+    }
+
+    void MultiplexedTransport::SetFlags( uint64_t flags )
+    {
+        m_transport->SetFlags( flags );
+    }
+
+    uint64_t MultiplexedTransport::GetFlags() const
+    {
+        return m_transport->GetFlags();
+    }
+
+    const Address & MultiplexedTransport::GetAddress() const
+    {
+        return m_transport->GetAddress();
+    }
+
+    uint32_t MultiplexedTransport::GetProtocolId() const
+    {
+        return m_transport->GetProtocolId();
+    }
+
+    PacketFactory * MultiplexedTransport::GetPacketFactory()
+    {
+        return m_transport->GetPacketFactory();
+    }
+
+    bool MultiplexedTransport::QueueReceivedPacket( const Address & from, Packet * packet, uint64_t sequence )
+    {
+        if ( m_receiveQueue.IsFull() )
+            return false;
+
+        PacketEntry entry;
+        entry.sequence = sequence;
+        entry.address = from;
+        entry.packet = packet;
+
+        m_receiveQueue.Push( entry );
+
+        return true;
+    }
+
+    void MultiplexedTransport::FlushSendQueue()
+    {
+        while ( !m_sendQueue.IsEmpty() )
+        {
+            PacketEntry entry = m_sendQueue.Pop();
+            m_transport->SendPacket( entry.address, entry.packet, entry.sequence );
+        }
+    }
+
+    void MultiplexedTransport::ClearSendQueue()
+    {
+        for ( int i = 0; i < m_sendQueue.GetNumEntries(); ++i )
+        {
+            PacketEntry & entry = m_sendQueue[i];
+            assert( entry.packet );
+            entry.packet->Destroy();
+            entry.address = Address();
+            entry.packet = NULL;
+        }
+
+        m_sendQueue.Clear();
+    }
+
+    void MultiplexedTransport::ClearReceiveQueue()
+    {
+        for ( int i = 0; i < m_receiveQueue.GetNumEntries(); ++i )
+        {
+            PacketEntry & entry = m_receiveQueue[i];
+            assert( entry.packet );
+            entry.packet->Destroy();
+            entry.address = Address();
+            entry.packet = NULL;
+        }
+
+        m_receiveQueue.Clear();
+    }
+}
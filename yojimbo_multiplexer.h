@@ -0,0 +1,244 @@
+/*
+    Yojimbo Client/Server Network Library.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef YOJIMBO_MULTIPLEXER_H
+#define YOJIMBO_MULTIPLEXER_H
+
+#include "yojimbo_config.h"
+#include "yojimbo_queue.h"
+#include "yojimbo_transport.h"
+#include "yojimbo_encryption.h"
+
+namespace yojimbo
+{
+    const int MaxMultiplexedTransports = 64;
+
+    enum MultiplexerCounters
+    {
+        MULTIPLEXER_COUNTER_PACKETS_ROUTED,
+        MULTIPLEXER_COUNTER_UNROUTED_PACKETS,
+        MULTIPLEXER_COUNTER_UNKNOWN_SERVER_ID,
+        MULTIPLEXER_COUNTER_RECEIVE_QUEUE_OVERFLOW,
+        MULTIPLEXER_COUNTER_SEND_QUEUE_OVERFLOW,
+        MULTIPLEXER_COUNTER_ROUTE_TABLE_FULL,
+        MULTIPLEXER_COUNTER_NUM_COUNTERS
+    };
+
+    class MultiplexedTransport;
+
+    class TransportMultiplexer : public TransportListener
+    {
+        // Hosts several servers on one transport, so they share the socket, packet processors and encryption table.
+        // Each server is given its own MultiplexedTransport. Packets are routed to it by the address of the client.
+        // A connection request from a new address goes to the endpoint with the server id in the request, which is
+        // sent in the clear and bound to the connect token as additional data, so each request costs one decrypt.
+        // Give each hosted server a distinct server id and call Server::SetServerId with it. Anything else from an
+        // address with no route is dropped.
+
+    public:
+
+        TransportMultiplexer( Transport & transport );
+
+        ~TransportMultiplexer();
+
+        void ReadPackets();
+
+        void WritePackets();
+
+        void AdvanceTime( double time );
+
+        double GetTime() const;
+
+        Transport & GetTransport() { return *m_transport; }
+
+        int GetNumEndpoints() const { return m_numEndpoints; }
+
+        uint64_t GetCounter( int index ) const;
+
+    protected:
+
+        friend class MultiplexedTransport;
+
+        bool ProcessRawPacket( const Address & from, const uint8_t * packetData, int packetBytes );
+
+        bool AddEndpoint( MultiplexedTransport * endpoint );
+
+        void RemoveEndpoint( MultiplexedTransport * endpoint );
+
+        MultiplexedTransport * FindEndpoint( uint64_t serverId );
+
+        int FindRoute( const Address & address );
+
+        bool AddRoute( const Address & address, MultiplexedTransport * endpoint );
+
+        void RemoveRoute( const Address & address );
+
+        void RemoveRoutes( MultiplexedTransport * endpoint );
+
+        void RemoveContextMappings( MultiplexedTransport * endpoint );
+
+    private:
+
+        Transport * m_transport;                                            // the shared transport. the multiplexer is its listener.
+
+        double m_time;                                                      // current time. routes not used for a while expire, just like encryption mappings.
+
+        int m_numEndpoints;                                                 // number of endpoints in the array below.
+
+        MultiplexedTransport * m_endpoints[MaxMultiplexedTransports];       // endpoint per hosted server. server ids are unique.
+
+        int m_numRoutes;                                                    // one past the highest route index in use.
+
+        Address m_routeAddress[MaxEncryptionMappings];                      // client address for each route. routes only exist alongside an encryption mapping.
+
+        MultiplexedTransport * m_routeEndpoint[MaxEncryptionMappings];      // endpoint packets from the route address are delivered to. NULL if the entry is free.
+
+        double m_routeLastAccessTime[MaxEncryptionMappings];                // last time a packet came in on the route.
+
+        uint64_t m_counters[MULTIPLEXER_COUNTER_NUM_COUNTERS];
+
+        TransportMultiplexer( const TransportMultiplexer & other );
+
+        TransportMultiplexer & operator = ( const TransportMultiplexer & other );
+    };
+
+    class MultiplexedTransport : public Transport
+    {
+        // IMPORTANT: encryption and packet serialization go through the shared transport. Encryption and context mappings
+        // the server adds claim the client address for this endpoint. Packets are queued here until the multiplexer writes
+        // them, so Reset only drops this server's packets. Reading, writing and time are driven through the multiplexer
+        // instead, so ReadPackets, WritePackets and AdvanceTime do nothing here.
+
+    public:
+
+        MultiplexedTransport( Allocator & allocator, TransportMultiplexer & multiplexer, uint64_t serverId, int sendQueueSize = 1024, int receiveQueueSize = 1024 );
+
+        ~MultiplexedTransport();
+
+        void Reset();
+
+        Packet * CreatePacket( int type );
+
+        void SendPacket( const Address & address, Packet * packet, uint64_t sequence = 0, bool immediate = false );
+
+        void SendPacketImmediate( const Address & address, Packet * packet, uint64_t sequence = 0 );
+
+        Packet * ReceivePacket( Address & from, uint64_t * sequence = NULL );
+
+        void WritePackets() {}
+
+        void ReadPackets() {}
+
+        int GetMaxPacketSize() const;
+
+        void SetContext( void * context );
+
+        void SetListener( TransportListener * listener );
+
+        void SetWorkerPool( WorkerPool * workerPool );
+
+        void SetStreamAllocator( Allocator & allocator );
+
+        void EnablePacketEncryption();
+
+        void DisableEncryptionForPacketType( int type );
+
+        bool IsEncryptedPacketType( int type ) const;
+
+        bool AddEncryptionMapping( const Address & address, const uint8_t * sendKey, const uint8_t * receiveKey );
+
+        bool RemoveEncryptionMapping( const Address & address );
+
+        void ResetEncryptionMappings();
+
+        bool AddContextMapping( const Address & address, Allocator & streamAllocator, PacketFactory & packetFactory, void * contextData );
+
+        bool RemoveContextMapping( const Address & address );
+
+        void ResetContextMappings();
+
+        void AdvanceTime( double /*time*/ ) {}
+
+        double GetTime() const;
+
+        uint64_t GetCounter( int index ) const;
+
+        void SetFlags( uint64_t flags );
+
+        uint64_t GetFlags() const;
+
+        const Address & GetAddress() const;
+
+        uint32_t GetProtocolId() const;
+
+        PacketFactory * GetPacketFactory();
+
+        TransportListener * GetListener() { return m_listener; }
+
+        uint64_t GetServerId() const { return m_serverId; }
+
+    protected:
+
+        friend class TransportMultiplexer;
+
+        bool QueueReceivedPacket( const Address & from, Packet * packet, uint64_t sequence );
+
+        void FlushSendQueue();
+
+        void ClearSendQueue();
+
+        void ClearReceiveQueue();
+
+    private:
+
+        struct PacketEntry
+        {
+            uint64_t sequence;
+            Address address;
+            Packet * packet;
+        };
+
+        TransportMultiplexer * m_multiplexer;                               // multiplexer this endpoint is registered with.
+
+        Transport * m_transport;                                            // the shared transport.
+
+        uint64_t m_serverId;                                                // connection requests with this server id are routed here.
+
+        TransportListener * m_listener;                                     // listener set by the server. raw packets routed here are passed to it.
+
+        Allocator * m_streamAllocator;                                      // global stream allocator set by the server. NULL until set.
+
+        void * m_context;                                                   // global context set by the server.
+
+        Queue<PacketEntry> m_sendQueue;                                     // packets sent by this endpoint, waiting to be handed to the shared transport.
+
+        Queue<PacketEntry> m_receiveQueue;                                  // packets routed to this endpoint, waiting to be received by the server.
+
+        MultiplexedTransport( const MultiplexedTransport & other );
+
+        MultiplexedTransport & operator = ( const MultiplexedTransport & other );
+    };
+}
+
+#endif // #ifndef YOJIMBO_MULTIPLEXER_H
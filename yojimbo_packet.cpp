@@ -119,28 +119,17 @@ namespace yojimbo
         return stream.GetBytesProcessed();
     }
 
-    Packet * ReadPacket( const PacketReadWriteInfo & info, const uint8_t * buffer, int bufferSize, int * errorCode )
+    static bool read_packet_header( const PacketReadWriteInfo & info, ReadStream & stream, const uint8_t * buffer, int bufferSize, int & packetType, int * errorCode )
     {
-        assert( buffer );
-        assert( bufferSize > 0 );
-        assert( info.protocolId != 0 );
-        assert( info.packetFactory );
-        assert( info.streamAllocator );
-
-        if ( errorCode )
-            *errorCode = YOJIMBO_PROTOCOL_ERROR_NONE;
-
-        ReadStream stream( buffer, bufferSize, *info.streamAllocator );
-
-        stream.SetContext( info.context );
-
         for ( int i = 0; i < info.prefixBytes; ++i )
         {
             uint32_t dummy = 0;
             if ( !stream.SerializeBits( dummy, 8 ) )
             {
                 debug_printf( "serialize prefix byte failed (read packet)\n" );
-                return 0;
+                if ( errorCode )
+                    *errorCode = YOJIMBO_PROTOCOL_ERROR_SERIALIZE_HEADER_FAILED;
+                return false;
             }
         }
 
@@ -151,7 +140,9 @@ namespace yojimbo
             if ( !stream.SerializeBits( read_crc32, 32 ) )
             {
                 debug_printf( "serialize crc32 failed (read packet)\n" );
-                return 0;
+                if ( errorCode )
+                    *errorCode = YOJIMBO_PROTOCOL_ERROR_SERIALIZE_HEADER_FAILED;
+                return false;
             }
 
             uint32_t network_protocolId = host_to_network( info.protocolId );
@@ -165,11 +156,11 @@ namespace yojimbo
                 debug_printf( "corrupt packet. expected crc32 %x, got %x (read packet)\n", crc32, read_crc32 );
                 if ( errorCode )
                     *errorCode = YOJIMBO_PROTOCOL_ERROR_CRC32_MISMATCH;
-                return NULL;
+                return false;
             }
         }
 
-        int packetType = 0;
+        packetType = 0;
 
         const int numPacketTypes = info.packetFactory->GetNumPacketTypes();
 
@@ -182,7 +173,7 @@ namespace yojimbo
                 debug_printf( "invalid packet type %d (read packet)\n", packetType );
                 if ( errorCode )
                     *errorCode = YOJIMBO_PROTOCOL_ERROR_INVALID_PACKET_TYPE;
-                return NULL;
+                return false;
             }
         }
 
@@ -193,25 +184,21 @@ namespace yojimbo
                 debug_printf( "packet type %d not allowed (read packet)\n", packetType );
                 if ( errorCode )
                     *errorCode = YOJIMBO_PROTOCOL_ERROR_PACKET_TYPE_NOT_ALLOWED;
-                return NULL;
+                return false;
             }
         }
 
-        Packet * packet = info.packetFactory->CreatePacket( packetType );
-        if ( !packet )
-        {
-            debug_printf( "create packet type %d failed (read packet)\n", packetType );
-            if ( errorCode )
-                *errorCode = YOJIMBO_PROTOCOL_ERROR_CREATE_PACKET_FAILED;
-            return NULL;
-        }
+        return true;
+    }
 
-        if ( !packet->SerializeInternal( stream ) )
+    static bool read_packet_body( ReadStream & stream, Packet & packet, int packetType, int * errorCode )
+    {
+        if ( !packet.SerializeInternal( stream ) )
         {
             debug_printf( "serialize packet type %d failed (read packet)\n", packetType );
             if ( errorCode )
                 *errorCode = YOJIMBO_PROTOCOL_ERROR_SERIALIZE_PACKET_FAILED;
-            goto cleanup;
+            return false;
         }
 
 #if YOJIMBO_SERIALIZE_CHECKS
@@ -220,7 +207,7 @@ namespace yojimbo
             debug_printf( "serialize check failed at end of packet type %d (read packet)\n", packetType );
             if ( errorCode )
                 *errorCode = YOJIMBO_PROTOCOL_ERROR_SERIALIZE_CHECK_FAILED;
-            goto cleanup;
+            return false;
         }
 #endif // #if YOJIMBO_SERIALIZE_CHECKS
 
@@ -229,16 +216,78 @@ namespace yojimbo
             debug_printf( "stream error %d (read packet)\n", stream.GetError() );
             if ( errorCode )
                 *errorCode = stream.GetError();
-            goto cleanup;
+            return false;
+        }
+
+        return true;
+    }
+
+    Packet * ReadPacket( const PacketReadWriteInfo & info, const uint8_t * buffer, int bufferSize, int * errorCode )
+    {
+        assert( buffer );
+        assert( bufferSize > 0 );
+        assert( info.protocolId != 0 );
+        assert( info.packetFactory );
+        assert( info.streamAllocator );
+
+        if ( errorCode )
+            *errorCode = YOJIMBO_PROTOCOL_ERROR_NONE;
+
+        ReadStream stream( buffer, bufferSize, *info.streamAllocator );
+
+        stream.SetContext( info.context );
+
+        int packetType = 0;
+
+        if ( !read_packet_header( info, stream, buffer, bufferSize, packetType, errorCode ) )
+            return NULL;
+
+        Packet * packet = info.packetFactory->CreatePacket( packetType );
+        if ( !packet )
+        {
+            debug_printf( "create packet type %d failed (read packet)\n", packetType );
+            if ( errorCode )
+                *errorCode = YOJIMBO_PROTOCOL_ERROR_CREATE_PACKET_FAILED;
+            return NULL;
+        }
+
+        if ( !read_packet_body( stream, *packet, packetType, errorCode ) )
+        {
+            packet->Destroy();
+            return NULL;
         }
 
         return packet;
+    }
+
+    bool ReadPacketInPlace( const PacketReadWriteInfo & info, const uint8_t * buffer, int bufferSize, int packetType, Packet & packet, int * errorCode )
+    {
+        assert( buffer );
+        assert( bufferSize > 0 );
+        assert( info.protocolId != 0 );
+        assert( info.packetFactory );
+        assert( info.streamAllocator );
+
+        if ( errorCode )
+            *errorCode = YOJIMBO_PROTOCOL_ERROR_NONE;
+
+        ReadStream stream( buffer, bufferSize, *info.streamAllocator );
+
+        stream.SetContext( info.context );
+
+        int readPacketType = 0;
 
-cleanup:
+        if ( !read_packet_header( info, stream, buffer, bufferSize, readPacketType, errorCode ) )
+            return false;
 
-        packet->Destroy();
+        if ( readPacketType != packetType )
+        {
+            if ( errorCode )
+                *errorCode = YOJIMBO_PROTOCOL_ERROR_UNEXPECTED_PACKET_TYPE;
+            return false;
+        }
 
-        return NULL;
+        return read_packet_body( stream, packet, packetType, errorCode );
     }
 
     PacketFactory::PacketFactory( Allocator & allocator, int numPacketTypes )
@@ -161,6 +161,8 @@ namespace yojimbo
     int WritePacket( const PacketReadWriteInfo & info, Packet * packet, uint8_t * buffer, int bufferSize );
 
     Packet * ReadPacket( const PacketReadWriteInfo & info, const uint8_t * buffer, int bufferSize, int * errorCode = NULL );
+
+    bool ReadPacketInPlace( const PacketReadWriteInfo & info, const uint8_t * buffer, int bufferSize, int packetType, Packet & packet, int * errorCode = NULL );
 }
 
 #define YOJIMBO_PACKET_FACTORY_START( factory_class, base_factory_class, num_packet_types )                         \
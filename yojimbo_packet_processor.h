@@ -71,6 +71,8 @@ namespace yojimbo
 
         int GetMaxPacketSize() const { return m_maxPacketSize; }
 
+        int GetAbsoluteMaxPacketSize() const { return m_absoluteMaxPacketSize; }
+
         int GetError() const { return m_error; }
 
     private:
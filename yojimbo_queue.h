@@ -51,7 +51,8 @@ namespace yojimbo
             m_numEntries = 0;
             m_allocator = &allocator;
             m_entries = (T*) allocator.Allocate( sizeof(T) * size );
-            memset( m_entries, 0, sizeof(T) * size );
+            for ( int i = 0; i < size; ++i )
+                new ( m_entries + i ) T();
         }
 
         ~Queue()
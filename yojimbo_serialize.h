@@ -414,6 +414,27 @@ namespace yojimbo
                 return false;                                                                       \
         } while (0)
 
+    inline int sequence_relative_bits( uint16_t previous, uint16_t current )
+    {
+        // number of bits serialize_sequence_relative writes for current relative to previous, without running a measure stream.
+        // IMPORTANT: this table must match the buckets in serialize_int_relative_internal.
+
+        static const uint32_t maxDifference[] = { 1, 6, 23, 280, 4377, 69914 };
+        static const int differenceBits[] = { 1, 5, 8, 13, 18, 23 };
+
+        const uint32_t difference = uint16_t( current - previous );
+
+        assert( difference > 0 );
+
+        for ( int i = 0; i < (int) ( sizeof( maxDifference ) / sizeof( maxDifference[0] ) ); ++i )
+        {
+            if ( difference <= maxDifference[i] )
+                return differenceBits[i];
+        }
+
+        return 0;
+    }
+
     #define read_bits( stream, value, bits )                                                \
     do                                                                                      \
     {                                                                                       \
@@ -44,6 +44,7 @@ namespace yojimbo
     #define YOJIMBO_PROTOCOL_ERROR_SERIALIZE_CHECK_FAILED       7
     #define YOJIMBO_PROTOCOL_ERROR_STREAM_OVERFLOW              8
     #define YOJIMBO_PROTOCOL_ERROR_STREAM_ABORTED               9
+    #define YOJIMBO_PROTOCOL_ERROR_UNEXPECTED_PACKET_TYPE       10
 
     class WriteStream
     {
@@ -84,6 +85,15 @@ namespace yojimbo
             return true;
         }
 
+        bool SerializeBitStream( const uint32_t * data, int bitOffset, int bits )
+        {
+            assert( data );
+            assert( bitOffset >= 0 );
+            assert( bits >= 0 );
+            m_writer.WriteBitStream( data, bitOffset, bits );
+            return true;
+        }
+
         bool SerializeAlign()
         {
             m_writer.WriteAlign();
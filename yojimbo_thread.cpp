@@ -0,0 +1,369 @@
+/*
+    Yojimbo Client/Server Network Library.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "yojimbo_thread.h"
+#include "yojimbo_allocator.h"
+#include "yojimbo_common.h"
+#include <assert.h>
+#include <new>
+
+#if defined(_WIN32)
+
+// ===========================================================================================================================================
+// Windows threads
+// ===========================================================================================================================================
+
+#define NOMINMAX
+#include <windows.h>
+
+namespace yojimbo
+{
+    typedef char mutex_storage_check[ sizeof( SRWLOCK ) <= ThreadPrimitiveStorageBytes ? 1 : -1 ];
+    typedef char condition_storage_check[ sizeof( CONDITION_VARIABLE ) <= ThreadPrimitiveStorageBytes ? 1 : -1 ];
+
+    int atomic_add( volatile int * value, int delta )
+    {
+        return (int) InterlockedExchangeAdd( (volatile LONG*) value, (LONG) delta ) + delta;
+    }
+
+    Mutex::Mutex()
+    {
+        InitializeSRWLock( (SRWLOCK*) m_storage );
+    }
+
+    Mutex::~Mutex()
+    {
+        // SRW locks don't need to be destroyed
+    }
+
+    void Mutex::Acquire()
+    {
+        AcquireSRWLockExclusive( (SRWLOCK*) m_storage );
+    }
+
+    void Mutex::Release()
+    {
+        ReleaseSRWLockExclusive( (SRWLOCK*) m_storage );
+    }
+
+    Condition::Condition()
+    {
+        InitializeConditionVariable( (CONDITION_VARIABLE*) m_storage );
+    }
+
+    Condition::~Condition()
+    {
+        // condition variables don't need to be destroyed
+    }
+
+    void Condition::Wait( Mutex & mutex )
+    {
+        SleepConditionVariableSRW( (CONDITION_VARIABLE*) m_storage, (SRWLOCK*) mutex.m_storage, INFINITE, 0 );
+    }
+
+    void Condition::Broadcast()
+    {
+        WakeAllConditionVariable( (CONDITION_VARIABLE*) m_storage );
+    }
+
+    struct ThreadEntry
+    {
+        static DWORD WINAPI Start( LPVOID data )
+        {
+            Thread * thread = (Thread*) data;
+            thread->m_function( thread->m_data );
+            return 0;
+        }
+    };
+
+    bool Thread::Start( ThreadFunction function, void * data )
+    {
+        assert( !m_running );
+        m_function = function;
+        m_data = data;
+        HANDLE handle = CreateThread( NULL, 0, ThreadEntry::Start, this, 0, NULL );
+        if ( !handle )
+            return false;
+        *( (HANDLE*) m_storage ) = handle;
+        m_running = true;
+        return true;
+    }
+
+    void Thread::Join()
+    {
+        if ( !m_running )
+            return;
+        HANDLE handle = *( (HANDLE*) m_storage );
+        WaitForSingleObject( handle, INFINITE );
+        CloseHandle( handle );
+        m_running = false;
+    }
+}
+
+#else
+
+// ===========================================================================================================================================
+// POSIX threads (Linux and MacOSX)
+// ===========================================================================================================================================
+
+#include <pthread.h>
+
+namespace yojimbo
+{
+    typedef char mutex_storage_check[ sizeof( pthread_mutex_t ) <= ThreadPrimitiveStorageBytes ? 1 : -1 ];
+    typedef char condition_storage_check[ sizeof( pthread_cond_t ) <= ThreadPrimitiveStorageBytes ? 1 : -1 ];
+    typedef char thread_storage_check[ sizeof( pthread_t ) <= sizeof( uint64_t ) * 2 ? 1 : -1 ];
+
+    int atomic_add( volatile int * value, int delta )
+    {
+        return __sync_add_and_fetch( value, delta );
+    }
+
+    Mutex::Mutex()
+    {
+        pthread_mutex_init( (pthread_mutex_t*) m_storage, NULL );
+    }
+
+    Mutex::~Mutex()
+    {
+        pthread_mutex_destroy( (pthread_mutex_t*) m_storage );
+    }
+
+    void Mutex::Acquire()
+    {
+        pthread_mutex_lock( (pthread_mutex_t*) m_storage );
+    }
+
+    void Mutex::Release()
+    {
+        pthread_mutex_unlock( (pthread_mutex_t*) m_storage );
+    }
+
+    Condition::Condition()
+    {
+        pthread_cond_init( (pthread_cond_t*) m_storage, NULL );
+    }
+
+    Condition::~Condition()
+    {
+        pthread_cond_destroy( (pthread_cond_t*) m_storage );
+    }
+
+    void Condition::Wait( Mutex & mutex )
+    {
+        pthread_cond_wait( (pthread_cond_t*) m_storage, (pthread_mutex_t*) mutex.m_storage );
+    }
+
+    void Condition::Broadcast()
+    {
+        pthread_cond_broadcast( (pthread_cond_t*) m_storage );
+    }
+
+    struct ThreadEntry
+    {
+        static void * Start( void * data )
+        {
+            Thread * thread = (Thread*) data;
+            thread->m_function( thread->m_data );
+            return NULL;
+        }
+    };
+
+    bool Thread::Start( ThreadFunction function, void * data )
+    {
+        assert( !m_running );
+        m_function = function;
+        m_data = data;
+        if ( pthread_create( (pthread_t*) m_storage, NULL, ThreadEntry::Start, this ) != 0 )
+            return false;
+        m_running = true;
+        return true;
+    }
+
+    void Thread::Join()
+    {
+        if ( !m_running )
+            return;
+        pthread_join( *( (pthread_t*) m_storage ), NULL );
+        m_running = false;
+    }
+}
+
+#endif
+
+// ===========================================================================================================================================
+// Portable
+// ===========================================================================================================================================
+
+namespace yojimbo
+{
+    Thread::Thread()
+    {
+        m_running = false;
+        m_function = NULL;
+        m_data = NULL;
+        m_storage[0] = 0;
+        m_storage[1] = 0;
+    }
+
+    Thread::~Thread()
+    {
+        // IMPORTANT: threads must be joined before they are destroyed
+        assert( !m_running );
+    }
+
+    WorkerPool::WorkerPool( Allocator & allocator, int numWorkers )
+    {
+        assert( numWorkers > 0 );
+
+        m_allocator = &allocator;
+        m_numWorkers = numWorkers;
+        m_generation = 0;
+        m_numPendingWorkers = 0;
+        m_quit = false;
+        m_function = NULL;
+        m_data = NULL;
+        m_workerThreads = NULL;
+
+        if ( numWorkers == 1 )
+            return;
+
+        m_workerThreads = (WorkerThread*) allocator.Allocate( sizeof( WorkerThread ) * ( numWorkers - 1 ) );
+
+        for ( int i = 0; i < numWorkers - 1; ++i )
+        {
+            new ( &m_workerThreads[i] ) WorkerThread();
+            m_workerThreads[i].pool = this;
+            m_workerThreads[i].workerIndex = i + 1;
+        }
+
+        for ( int i = 0; i < numWorkers - 1; ++i )
+        {
+            if ( !m_workerThreads[i].thread.Start( WorkerThreadFunction, &m_workerThreads[i] ) )
+            {
+                // could not create every thread. the workers that did start still get their share of each run, the rest is done by worker 0.
+                debug_printf( "worker pool failed to create thread %d\n", i + 1 );
+            }
+        }
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        if ( !m_workerThreads )
+            return;
+
+        m_mutex.Acquire();
+        m_quit = true;
+        m_start.Broadcast();
+        m_mutex.Release();
+
+        for ( int i = 0; i < m_numWorkers - 1; ++i )
+        {
+            m_workerThreads[i].thread.Join();
+            m_workerThreads[i].~WorkerThread();
+        }
+
+        m_allocator->Free( m_workerThreads );
+        m_workerThreads = NULL;
+    }
+
+    void WorkerPool::Run( WorkerFunction function, void * data )
+    {
+        assert( function );
+
+        if ( m_numWorkers == 1 )
+        {
+            function( data, 0 );
+            return;
+        }
+
+        int numThreadsRunning = 0;
+        for ( int i = 0; i < m_numWorkers - 1; ++i )
+        {
+            if ( m_workerThreads[i].thread.IsRunning() )
+                numThreadsRunning++;
+        }
+
+        m_mutex.Acquire();
+        m_function = function;
+        m_data = data;
+        m_numPendingWorkers = numThreadsRunning;
+        m_generation++;
+        m_start.Broadcast();
+        m_mutex.Release();
+
+        function( data, 0 );
+
+        for ( int i = 0; i < m_numWorkers - 1; ++i )
+        {
+            if ( !m_workerThreads[i].thread.IsRunning() )
+                function( data, m_workerThreads[i].workerIndex );
+        }
+
+        m_mutex.Acquire();
+        while ( m_numPendingWorkers > 0 )
+            m_done.Wait( m_mutex );
+        m_mutex.Release();
+    }
+
+    void WorkerPool::WorkerThreadFunction( void * data )
+    {
+        WorkerThread * workerThread = (WorkerThread*) data;
+        workerThread->pool->WorkerLoop( workerThread->workerIndex );
+    }
+
+    void WorkerPool::WorkerLoop( int workerIndex )
+    {
+        uint64_t generation = 0;
+
+        while ( true )
+        {
+            m_mutex.Acquire();
+
+            while ( m_generation == generation && !m_quit )
+                m_start.Wait( m_mutex );
+
+            if ( m_quit )
+            {
+                m_mutex.Release();
+                return;
+            }
+
+            generation = m_generation;
+
+            WorkerFunction function = m_function;
+            void * data = m_data;
+
+            m_mutex.Release();
+
+            function( data, workerIndex );
+
+            m_mutex.Acquire();
+            if ( --m_numPendingWorkers == 0 )
+                m_done.Broadcast();
+            m_mutex.Release();
+        }
+    }
+}
@@ -0,0 +1,177 @@
+/*
+    Yojimbo Client/Server Network Library.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef YOJIMBO_THREAD_H
+#define YOJIMBO_THREAD_H
+
+#include "yojimbo_config.h"
+#include <stdint.h>
+
+namespace yojimbo
+{
+    class Allocator;
+
+    const int ThreadPrimitiveStorageBytes = 128;
+
+    int atomic_add( volatile int * value, int delta );                      // atomically adds delta to value and returns the new value.
+
+    class Mutex
+    {
+    public:
+
+        Mutex();
+
+        ~Mutex();
+
+        void Acquire();
+
+        void Release();
+
+    private:
+
+        friend class Condition;
+
+        uint64_t m_storage[ThreadPrimitiveStorageBytes/8];                  // platform mutex. opaque so platform headers don't leak out of this header.
+
+        Mutex( const Mutex & other );
+
+        Mutex & operator = ( const Mutex & other );
+    };
+
+    class Condition
+    {
+    public:
+
+        Condition();
+
+        ~Condition();
+
+        void Wait( Mutex & mutex );
+
+        void Broadcast();
+
+    private:
+
+        uint64_t m_storage[ThreadPrimitiveStorageBytes/8];                  // platform condition variable.
+
+        Condition( const Condition & other );
+
+        Condition & operator = ( const Condition & other );
+    };
+
+    typedef void (*ThreadFunction)( void * data );
+
+    class Thread
+    {
+    public:
+
+        Thread();
+
+        ~Thread();
+
+        bool Start( ThreadFunction function, void * data );
+
+        void Join();
+
+        bool IsRunning() const { return m_running; }
+
+    private:
+
+        friend struct ThreadEntry;
+
+        bool m_running;                                                     // true between a successful start and join.
+
+        ThreadFunction m_function;                                          // function to run on the thread.
+
+        void * m_data;                                                      // data passed to the thread function.
+
+        uint64_t m_storage[2];                                              // platform thread handle.
+
+        Thread( const Thread & other );
+
+        Thread & operator = ( const Thread & other );
+    };
+
+    typedef void (*WorkerFunction)( void * data, int workerIndex );
+
+    class WorkerPool
+    {
+        // Fork/join pool for splitting per-client work across cores. Run calls the function once per-worker with
+        // worker indices [0,numWorkers), the calling thread acts as worker 0, and it returns once every worker is done.
+
+    public:
+
+        WorkerPool( Allocator & allocator, int numWorkers );
+
+        ~WorkerPool();
+
+        void Run( WorkerFunction function, void * data );
+
+        int GetNumWorkers() const { return m_numWorkers; }
+
+    protected:
+
+        static void WorkerThreadFunction( void * data );
+
+        void WorkerLoop( int workerIndex );
+
+    private:
+
+        struct WorkerThread
+        {
+            WorkerPool * pool;
+            int workerIndex;
+            Thread thread;
+        };
+
+        Allocator * m_allocator;                                            // allocator used for the worker threads.
+
+        int m_numWorkers;                                                   // number of workers, including the thread calling run.
+
+        WorkerThread * m_workerThreads;                                     // worker threads. there are numWorkers - 1 of these.
+
+        Mutex m_mutex;                                                      // protects everything below.
+
+        Condition m_start;                                                  // signalled when there is new work, or the pool is shutting down.
+
+        Condition m_done;                                                   // signalled when the last worker finishes.
+
+        uint64_t m_generation;                                              // incremented each time run is called. workers wait for it to change.
+
+        int m_numPendingWorkers;                                            // number of worker threads still running the current function.
+
+        bool m_quit;                                                        // true when the pool is being destroyed.
+
+        WorkerFunction m_function;                                          // function for the current run.
+
+        void * m_data;                                                      // data for the current run.
+
+        WorkerPool( const WorkerPool & other );
+
+        WorkerPool & operator = ( const WorkerPool & other );
+    };
+}
+
+#endif // #ifndef YOJIMBO_THREAD_H
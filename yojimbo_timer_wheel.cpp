@@ -0,0 +1,319 @@
+/*
+    Yojimbo Client/Server Network Library.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "yojimbo_timer_wheel.h"
+#include "yojimbo_allocator.h"
+#include <assert.h>
+#include <stddef.h>
+
+namespace yojimbo
+{
+    TimerWheel::TimerWheel( Allocator & allocator, int numTimers, double resolution, double time )
+    {
+        assert( numTimers > 0 );
+        assert( resolution > 0.0 );
+
+        m_allocator = &allocator;
+        m_numTimers = numTimers;
+        m_numScheduled = 0;
+        m_resolution = resolution;
+        m_time = time;
+        m_currentTick = GetTick( time );
+
+        m_deadline = (double*) allocator.Allocate( sizeof( double ) * numTimers );
+        m_timerTick = (uint64_t*) allocator.Allocate( sizeof( uint64_t ) * numTimers );
+        m_bucket = (int*) allocator.Allocate( sizeof( int ) * numTimers );
+        m_next = (int*) allocator.Allocate( sizeof( int ) * numTimers );
+        m_prev = (int*) allocator.Allocate( sizeof( int ) * numTimers );
+
+        for ( int i = 0; i < numTimers; ++i )
+        {
+            m_deadline[i] = 0.0;
+            m_timerTick[i] = 0;
+            m_bucket[i] = -1;
+            m_next[i] = -1;
+            m_prev[i] = -1;
+        }
+
+        for ( int i = 0; i <= ExpiredBucket; ++i )
+        {
+            m_head[i] = -1;
+            m_tail[i] = -1;
+        }
+
+        for ( int i = 0; i < TimerWheelLevels; ++i )
+            m_numScheduledLevel[i] = 0;
+    }
+
+    TimerWheel::~TimerWheel()
+    {
+        assert( m_allocator );
+
+        m_allocator->Free( m_deadline );
+        m_allocator->Free( m_timerTick );
+        m_allocator->Free( m_bucket );
+        m_allocator->Free( m_next );
+        m_allocator->Free( m_prev );
+
+        m_deadline = NULL;
+        m_timerTick = NULL;
+        m_bucket = NULL;
+        m_next = NULL;
+        m_prev = NULL;
+        m_allocator = NULL;
+    }
+
+    void TimerWheel::Schedule( int timerId, double deadline )
+    {
+        assert( timerId >= 0 );
+        assert( timerId < m_numTimers );
+
+        Unlink( timerId );
+
+        m_deadline[timerId] = deadline;
+        m_timerTick[timerId] = GetTick( deadline );
+
+        Link( timerId );
+    }
+
+    void TimerWheel::Cancel( int timerId )
+    {
+        assert( timerId >= 0 );
+        assert( timerId < m_numTimers );
+
+        Unlink( timerId );
+    }
+
+    bool TimerWheel::IsScheduled( int timerId ) const
+    {
+        assert( timerId >= 0 );
+        assert( timerId < m_numTimers );
+        return m_bucket[timerId] != -1;
+    }
+
+    double TimerWheel::GetDeadline( int timerId ) const
+    {
+        assert( timerId >= 0 );
+        assert( timerId < m_numTimers );
+        return m_deadline[timerId];
+    }
+
+    void TimerWheel::Advance( double time )
+    {
+        assert( time >= m_time );
+
+        m_time = time;
+
+        const uint64_t targetTick = GetTick( time );
+
+        // the target tick is processed on every advance, because it can hold timers that are due later within that tick.
+        // it stays the current tick afterwards, so those timers are looked at again next time.
+
+        while ( true )
+        {
+            if ( m_numScheduled == 0 )
+            {
+                if ( m_currentTick < targetTick )
+                    m_currentTick = targetTick;
+                break;
+            }
+
+            const uint64_t tick = m_currentTick;
+
+            // cascade coarse slots down before looking at this tick. top down, so a timer can fall through several levels at once.
+
+            for ( int level = TimerWheelLevels - 1; level > 0; --level )
+            {
+                const int shift = TimerWheelSlotBits * level;
+
+                if ( ( tick & ( ( uint64_t(1) << shift ) - 1 ) ) == 0 )
+                    Cascade( level, int( ( tick >> shift ) & ( TimerWheelSlots - 1 ) ) );
+            }
+
+            const int bucket = int( tick & ( TimerWheelSlots - 1 ) );
+
+            int timerId = m_head[bucket];
+
+            m_head[bucket] = -1;
+            m_tail[bucket] = -1;
+
+            while ( timerId != -1 )
+            {
+                const int next = m_next[timerId];
+
+                assert( m_timerTick[timerId] <= tick );
+
+                m_bucket[timerId] = -1;
+                m_numScheduled--;
+                m_numScheduledLevel[0]--;
+
+                if ( m_deadline[timerId] <= time )
+                    Append( ExpiredBucket, timerId );
+                else
+                    Link( timerId );
+
+                timerId = next;
+            }
+
+            if ( tick >= targetTick )
+                break;
+
+            // nothing happens until the next cascade of the finest level holding timers, so skip straight to it.
+            // this keeps large jumps in time cheap, even with timers far out in the future.
+
+            int level = 0;
+            while ( level < TimerWheelLevels - 1 && m_numScheduledLevel[level] == 0 )
+                level++;
+
+            uint64_t nextTick = tick + 1;
+
+            if ( level > 0 )
+            {
+                const int shift = TimerWheelSlotBits * level;
+                nextTick = ( ( tick >> shift ) + 1 ) << shift;
+            }
+
+            m_currentTick = ( nextTick < targetTick ) ? nextTick : targetTick;
+        }
+    }
+
+    int TimerWheel::PopExpired()
+    {
+        const int timerId = m_head[ExpiredBucket];
+
+        if ( timerId != -1 )
+            Unlink( timerId );
+
+        return timerId;
+    }
+
+    uint64_t TimerWheel::GetTick( double time ) const
+    {
+        if ( time <= 0.0 )
+            return 0;
+
+        return uint64_t( time / m_resolution );
+    }
+
+    void TimerWheel::Append( int bucket, int timerId )
+    {
+        assert( bucket >= 0 );
+        assert( bucket <= ExpiredBucket );
+        assert( m_bucket[timerId] == -1 );
+
+        m_bucket[timerId] = bucket;
+        m_next[timerId] = -1;
+        m_prev[timerId] = m_tail[bucket];
+
+        if ( m_tail[bucket] != -1 )
+            m_next[m_tail[bucket]] = timerId;
+        else
+            m_head[bucket] = timerId;
+
+        m_tail[bucket] = timerId;
+    }
+
+    void TimerWheel::Unlink( int timerId )
+    {
+        const int bucket = m_bucket[timerId];
+
+        if ( bucket == -1 )
+            return;
+
+        if ( m_prev[timerId] != -1 )
+            m_next[m_prev[timerId]] = m_next[timerId];
+        else
+            m_head[bucket] = m_next[timerId];
+
+        if ( m_next[timerId] != -1 )
+            m_prev[m_next[timerId]] = m_prev[timerId];
+        else
+            m_tail[bucket] = m_prev[timerId];
+
+        m_bucket[timerId] = -1;
+        m_next[timerId] = -1;
+        m_prev[timerId] = -1;
+
+        if ( bucket != ExpiredBucket )
+        {
+            m_numScheduled--;
+            m_numScheduledLevel[bucket/TimerWheelSlots]--;
+        }
+    }
+
+    void TimerWheel::Link( int timerId )
+    {
+        // timers already in the past go in the current tick, which is processed on the next advance.
+        // timers further out than the wheel can represent go in the top level, and are placed again when that slot cascades.
+
+        uint64_t tick = m_timerTick[timerId];
+
+        if ( tick < m_currentTick )
+            tick = m_currentTick;
+
+        const uint64_t maxDelta = ( uint64_t(1) << ( TimerWheelSlotBits * TimerWheelLevels ) ) - 1;
+
+        if ( tick - m_currentTick > maxDelta )
+            tick = m_currentTick + maxDelta;
+
+        const uint64_t delta = tick - m_currentTick;
+
+        int level = 0;
+        while ( level < TimerWheelLevels - 1 && delta >= ( uint64_t(1) << ( TimerWheelSlotBits * ( level + 1 ) ) ) )
+            level++;
+
+        const int slot = int( ( tick >> ( TimerWheelSlotBits * level ) ) & ( TimerWheelSlots - 1 ) );
+
+        Append( level * TimerWheelSlots + slot, timerId );
+
+        m_numScheduled++;
+        m_numScheduledLevel[level]++;
+    }
+
+    void TimerWheel::Cascade( int level, int slot )
+    {
+        assert( level > 0 );
+        assert( level < TimerWheelLevels );
+
+        const int bucket = level * TimerWheelSlots + slot;
+
+        int timerId = m_head[bucket];
+
+        m_head[bucket] = -1;
+        m_tail[bucket] = -1;
+
+        while ( timerId != -1 )
+        {
+            const int next = m_next[timerId];
+
+            m_bucket[timerId] = -1;
+            m_numScheduled--;
+            m_numScheduledLevel[level]--;
+
+            Link( timerId );
+
+            timerId = next;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+/*
+    Yojimbo Client/Server Network Library.
+
+    Copyright © 2016, The Network Protocol Company, Inc.
+
+    Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+        1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+        2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer 
+           in the documentation and/or other materials provided with the distribution.
+
+        3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived 
+           from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+    INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE 
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR 
+    SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+    WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+    USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef YOJIMBO_TIMER_WHEEL_H
+#define YOJIMBO_TIMER_WHEEL_H
+
+#include "yojimbo_config.h"
+#include <stdint.h>
+
+namespace yojimbo
+{
+    class Allocator;
+
+    const int TimerWheelLevels = 4;
+    const int TimerWheelSlotBits = 6;
+    const int TimerWheelSlots = 1 << TimerWheelSlotBits;
+
+    /**
+        Hierarchical timer wheel.
+
+        Holds a fixed set of timers identified by index, each with at most one pending deadline. Scheduling and 
+        cancelling are O(1) and never allocate. Advancing only touches timers that are due, plus an occasional 
+        cascade of a coarser slot into finer ones, so the cost of a tick does not grow with the number of timers.
+
+        Deadlines are bucketed at the wheel resolution, but a timer only expires once its exact deadline is reached.
+     */
+
+    class TimerWheel
+    {
+    public:
+
+        TimerWheel( Allocator & allocator, int numTimers, double resolution, double time );
+
+        ~TimerWheel();
+
+        void Schedule( int timerId, double deadline );
+
+        void Cancel( int timerId );
+
+        bool IsScheduled( int timerId ) const;
+
+        double GetDeadline( int timerId ) const;
+
+        void Advance( double time );
+
+        int PopExpired();
+
+        int GetNumTimers() const { return m_numTimers; }
+
+        int GetNumScheduled() const { return m_numScheduled; }
+
+    protected:
+
+        uint64_t GetTick( double time ) const;
+
+        void Append( int bucket, int timerId );
+
+        void Unlink( int timerId );
+
+        void Link( int timerId );
+
+        void Cascade( int level, int slot );
+
+    private:
+
+        static const int ExpiredBucket = TimerWheelLevels * TimerWheelSlots;
+
+        Allocator * m_allocator;                                            // allocator used for the per-timer arrays.
+
+        int m_numTimers;                                                    // number of timers. timer ids are in [0,numTimers-1].
+
+        int m_numScheduled;                                                 // number of timers waiting in the wheel. does not include expired timers.
+
+        int m_numScheduledLevel[TimerWheelLevels];                          // number of timers waiting in each level of the wheel.
+
+        double m_resolution;                                                // width of one tick in seconds.
+
+        double m_time;                                                      // time passed to the last advance.
+
+        uint64_t m_currentTick;                                             // next tick to process. ticks before this have been processed.
+
+        double * m_deadline;                                                // exact deadline per-timer.
+
+        uint64_t * m_timerTick;                                             // deadline per-timer in ticks.
+
+        int * m_bucket;                                                     // bucket the timer is linked into, or -1 if the timer is not scheduled.
+
+        int * m_next;                                                       // next timer in the same bucket, or -1.
+
+        int * m_prev;                                                       // previous timer in the same bucket, or -1.
+
+        int m_head[ExpiredBucket+1];                                        // first timer per-bucket. the last bucket holds expired timers in expiry order.
+
+        int m_tail[ExpiredBucket+1];                                        // last timer per-bucket.
+
+        TimerWheel( const TimerWheel & other );
+
+        TimerWheel & operator = ( const TimerWheel & other );
+    };
+}
+
+#endif // #ifndef YOJIMBO_TIMER_WHEEL_H
@@ -29,6 +29,33 @@
 
 namespace yojimbo
 {
+    static const int WritePacketsPerWorker = 32;
+
+    static const int ReadPacketsPerWorker = 32;
+
+    static int address_shard( const Address & address, int numShards )
+    {
+        assert( numShards > 0 );
+
+        uint32_t key[5];
+        int keyBytes = 0;
+
+        if ( address.GetType() == ADDRESS_IPV4 )
+        {
+            key[0] = address.GetAddress4();
+            key[1] = address.GetPort();
+            keyBytes = 8;
+        }
+        else
+        {
+            memcpy( key, address.GetAddress6(), 16 );
+            key[4] = address.GetPort();
+            keyBytes = 20;
+        }
+
+        return (int) ( murmur_hash_64( key, keyBytes, 0 ) % uint64_t( numShards ) );
+    }
+
     BaseTransport::BaseTransport( Allocator & allocator, 
                                   PacketFactory & packetFactory, 
                                   const Address & address,
@@ -52,6 +79,22 @@ namespace yojimbo
 
         m_context = NULL;
 
+        m_listener = NULL;
+
+        m_workerPool = NULL;
+        m_workerPacketProcessors = NULL;
+        m_numWorkerPacketProcessors = 0;
+        m_writeBatchSize = 0;
+        m_writeBatchStride = 0;
+        m_numWriteEntries = 0;
+        m_writeEntries = NULL;
+        m_writeBatchBuffer = NULL;
+        m_readBatchSize = 0;
+        m_readBatchStride = 0;
+        m_numReadEntries = 0;
+        m_readEntries = NULL;
+        m_readBatchBuffer = NULL;
+
         m_allocator = &allocator;
                 
         m_streamAllocator = &GetDefaultAllocator();
@@ -87,6 +130,8 @@ namespace yojimbo
         ClearSendQueue();
         ClearReceiveQueue();
 
+        SetWorkerPool( NULL );
+
 #if YOJIMBO_INSECURE_CONNECT
         m_allocator->Free( m_allPacketTypes );
 #endif // #if YOJIMBO_INSECURE_CONNECT
@@ -190,6 +235,22 @@ namespace yojimbo
         m_counters[TRANSPORT_COUNTER_PACKETS_SENT]++;
     }
 
+    void BaseTransport::SendPacketImmediate( const Address & address, Packet * packet, uint64_t sequence )
+    {
+        assert( m_allocator );
+        assert( m_packetFactory );
+
+        assert( packet );
+        assert( packet->IsValid() );
+        assert( address.IsValid() );
+
+        // IMPORTANT: the caller keeps ownership of the packet. this lets handshake replies be sent from preallocated packets.
+
+        m_counters[TRANSPORT_COUNTER_PACKETS_SENT]++;
+
+        WriteAndFlushPacket( address, packet, sequence );
+    }
+
     Packet * BaseTransport::ReceivePacket( Address & from, uint64_t * sequence )
     {
         assert( m_allocator );
@@ -220,6 +281,12 @@ namespace yojimbo
         assert( m_packetFactory );
         assert( m_packetProcessor );
 
+        if ( m_workerPool && m_workerPool->GetNumWorkers() > 1 )
+        {
+            WritePacketsParallel();
+            return;
+        }
+
         while ( !m_sendQueue.IsEmpty() )
         {
             PacketEntry entry = m_sendQueue.Pop();
@@ -240,37 +307,69 @@ namespace yojimbo
         assert( packet->IsValid() );
         assert( address.IsValid() );
 
-        const int packetType = packet->GetType();
+        WriteEntry entry;
+        entry.address = address;
+        entry.packet = packet;
+        entry.sequence = sequence;
+
+        PrepareWriteEntry( entry );
+
+        const uint8_t * packetData = WriteEntryPacket( *m_packetProcessor, entry );
+
+        FlushWriteEntry( entry, packetData );
+    }
+
+    void BaseTransport::PrepareWriteEntry( WriteEntry & entry )
+    {
+        assert( entry.packet );
+
+        const int packetType = entry.packet->GetType();
 
         assert( packetType >= 0 );
         assert( packetType < m_packetFactory->GetNumPacketTypes() );
 
-        const uint8_t * key = m_encryptionManager.GetSendKey( address, GetTime() );
+        entry.key = m_encryptionManager.GetSendKey( entry.address, GetTime() );
 
 #if YOJIMBO_INSECURE_CONNECT
-        const bool encrypt = ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE ) ? IsEncryptedPacketType( packetType ) && key : IsEncryptedPacketType( packetType );
+        entry.encrypt = ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE ) ? IsEncryptedPacketType( packetType ) && entry.key : IsEncryptedPacketType( packetType );
 #else // #if YOJIMBO_INSECURE_CONNECT
-        const bool encrypt = IsEncryptedPacketType( packetType );
+        entry.encrypt = IsEncryptedPacketType( packetType );
 #endif // #if YOJIMBO_INSECURE_CONNECT
 
-        int packetBytes;
+        const Context * context = m_contextManager.GetContext( entry.address );
+
+        entry.context = context ? context->contextData : m_context;
+        entry.streamAllocator = context ? context->streamAllocator : m_streamAllocator;
+        entry.packetFactory = context ? context->packetFactory : m_packetFactory;
+        entry.error = PACKET_PROCESSOR_ERROR_NONE;
+        entry.packetBytes = 0;
 
-        const Context * context = m_contextManager.GetContext( address );
+        assert( entry.streamAllocator );
+        assert( entry.packetFactory );
+        assert( entry.packetFactory->GetNumPacketTypes() == m_packetFactory->GetNumPacketTypes() );
+    }
 
-        Allocator * streamAllocator = context ? context->streamAllocator : m_streamAllocator;
-        PacketFactory * packetFactory = context ? context->packetFactory : m_packetFactory;
+    const uint8_t * BaseTransport::WriteEntryPacket( PacketProcessor & packetProcessor, WriteEntry & entry )
+    {
+        // IMPORTANT: this may run on a worker thread. it must only touch the entry and the packet processor passed in.
 
-        assert( streamAllocator );
-        assert( packetFactory );
-        assert( packetFactory->GetNumPacketTypes() == m_packetFactory->GetNumPacketTypes() );
+        packetProcessor.SetContext( entry.context );
 
-        m_packetProcessor->SetContext( context ? context->contextData : m_context );
+        const uint8_t * packetData = packetProcessor.WritePacket( entry.packet, entry.sequence, entry.packetBytes, entry.encrypt, entry.key, *entry.streamAllocator, *entry.packetFactory );
 
-        const uint8_t * packetData = m_packetProcessor->WritePacket( packet, sequence, packetBytes, encrypt, key, *streamAllocator, *packetFactory );
+        entry.error = packetProcessor.GetError();
 
+        if ( !packetData )
+            entry.packetBytes = 0;
+
+        return packetData;
+    }
+
+    void BaseTransport::FlushWriteEntry( const WriteEntry & entry, const uint8_t * packetData )
+    {
         if ( !packetData )
         {
-            switch ( m_packetProcessor->GetError() )
+            switch ( entry.error )
             {
                 case PACKET_PROCESSOR_ERROR_KEY_IS_NULL:                
                 {
@@ -300,22 +399,103 @@ namespace yojimbo
             return;
         }
 
-        InternalSendPacket( address, packetData, packetBytes );
+        InternalSendPacket( entry.address, packetData, entry.packetBytes );
 
         m_counters[TRANSPORT_COUNTER_PACKETS_WRITTEN]++;
 
-        if ( encrypt )
+        if ( entry.encrypt )
             m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_WRITTEN]++;
         else
             m_counters[TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_WRITTEN]++;
     }
 
+    void BaseTransport::WritePacketsParallel()
+    {
+        assert( m_workerPool );
+        assert( m_writeEntries );
+        assert( m_writeBatchBuffer );
+
+        // key and context lookups, sends, counters and packet destruction stay on this thread.
+        // only serialization and encryption, which dominate write cost, are spread across workers.
+
+        while ( !m_sendQueue.IsEmpty() )
+        {
+            m_numWriteEntries = 0;
+
+            while ( m_numWriteEntries < m_writeBatchSize && !m_sendQueue.IsEmpty() )
+            {
+                PacketEntry packetEntry = m_sendQueue.Pop();
+
+                assert( packetEntry.packet );
+                assert( packetEntry.packet->IsValid() );
+                assert( packetEntry.address.IsValid() );
+
+                WriteEntry & entry = m_writeEntries[m_numWriteEntries++];
+                entry.address = packetEntry.address;
+                entry.packet = packetEntry.packet;
+                entry.sequence = packetEntry.sequence;
+
+                PrepareWriteEntry( entry );
+            }
+
+            m_workerPool->Run( WritePacketBatchWorker, this );
+
+            for ( int i = 0; i < m_numWriteEntries; ++i )
+            {
+                WriteEntry & entry = m_writeEntries[i];
+
+                FlushWriteEntry( entry, entry.packetBytes > 0 ? m_writeBatchBuffer + i * m_writeBatchStride : NULL );
+
+                entry.packet->Destroy();
+                entry.packet = NULL;
+            }
+
+            m_numWriteEntries = 0;
+        }
+    }
+
+    void BaseTransport::WritePacketBatchWorker( void * data, int workerIndex )
+    {
+        BaseTransport * transport = (BaseTransport*) data;
+        transport->WritePacketBatch( workerIndex );
+    }
+
+    void BaseTransport::WritePacketBatch( int workerIndex )
+    {
+        assert( workerIndex >= 0 );
+        assert( workerIndex < m_numWorkerPacketProcessors );
+
+        PacketProcessor & packetProcessor = *m_workerPacketProcessors[workerIndex];
+
+        const int begin = ( m_numWriteEntries * workerIndex ) / m_numWorkerPacketProcessors;
+        const int end = ( m_numWriteEntries * ( workerIndex + 1 ) ) / m_numWorkerPacketProcessors;
+
+        for ( int i = begin; i < end; ++i )
+        {
+            WriteEntry & entry = m_writeEntries[i];
+
+            const uint8_t * packetData = WriteEntryPacket( packetProcessor, entry );
+
+            if ( packetData )
+            {
+                assert( entry.packetBytes <= m_writeBatchStride );
+                memcpy( m_writeBatchBuffer + i * m_writeBatchStride, packetData, entry.packetBytes );
+            }
+        }
+    }
+
     void BaseTransport::ReadPackets()
     {
         assert( m_allocator );
         assert( m_packetFactory );
         assert( m_packetProcessor );
 
+        if ( m_workerPool && m_workerPool->GetNumWorkers() > 1 )
+        {
+            ReadPacketsParallel();
+            return;
+        }
+
         const int maxPacketSize = GetMaxPacketSize();
 
         uint8_t * packetBuffer = (uint8_t*) alloca( maxPacketSize );
@@ -329,6 +509,12 @@ namespace yojimbo
 
             assert( packetBytes > 0 );
 
+            if ( m_listener && m_listener->ProcessRawPacket( address, packetBuffer, packetBytes ) )
+            {
+                m_counters[TRANSPORT_COUNTER_RAW_PACKETS_HANDLED]++;
+                continue;
+            }
+
             if ( m_receiveQueue.IsFull() )
             {
                 debug_printf( "base transport receive queue overflow\n" );
@@ -336,88 +522,205 @@ namespace yojimbo
                 break;
             }
 
-            bool encrypted = false;
+            ReadEntry entry;
+            entry.address = address;
+            entry.packetData = packetBuffer;
+            entry.packetBytes = packetBytes;
+
+            PrepareReadEntry( entry );
+
+            ReadEntryPacket( *m_packetProcessor, entry );
+
+            FlushReadEntry( entry );
+        }
+    }
 
-            const uint8_t * encryptedPacketTypes = m_packetTypeIsEncrypted;
-            const uint8_t * unencryptedPacketTypes = m_packetTypeIsUnencrypted;
+    void BaseTransport::PrepareReadEntry( ReadEntry & entry )
+    {
+        entry.encryptedPacketTypes = m_packetTypeIsEncrypted;
+        entry.unencryptedPacketTypes = m_packetTypeIsUnencrypted;
 
 #if YOJIMBO_INSECURE_CONNECT
-            if ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE )
-            {
-                encryptedPacketTypes = m_allPacketTypes;
-                unencryptedPacketTypes = m_allPacketTypes;
-            }
+        if ( GetFlags() & TRANSPORT_FLAG_INSECURE_MODE )
+        {
+            entry.encryptedPacketTypes = m_allPacketTypes;
+            entry.unencryptedPacketTypes = m_allPacketTypes;
+        }
 #endif // #if YOJIMBO_INSECURE_CONNECT
 
-            const uint8_t * key = m_encryptionManager.GetReceiveKey( address, GetTime() );
-           
-            uint64_t sequence = 0;
+        entry.key = m_encryptionManager.GetReceiveKey( entry.address, GetTime() );
 
-            const Context * context = m_contextManager.GetContext( address );
+        const Context * context = m_contextManager.GetContext( entry.address );
 
-            Allocator * streamAllocator = context ? context->streamAllocator : m_streamAllocator;
-            PacketFactory * packetFactory = context ? context->packetFactory : m_packetFactory;
-    
-            assert( streamAllocator );
-            assert( packetFactory );
-            assert( packetFactory->GetNumPacketTypes() == m_packetFactory->GetNumPacketTypes() );
+        entry.context = context ? context->contextData : m_context;
+        entry.streamAllocator = context ? context->streamAllocator : m_streamAllocator;
+        entry.packetFactory = context ? context->packetFactory : m_packetFactory;
+        entry.packet = NULL;
+        entry.sequence = 0;
+        entry.encrypted = false;
+        entry.error = PACKET_PROCESSOR_ERROR_NONE;
+
+        // packets from the same address always land on the same worker. packets without a context mapping share the
+        // transport packet factory and stream allocator, so they are all read by worker 0, which is the calling thread.
+
+        entry.worker = ( context && m_numWorkerPacketProcessors > 1 ) ? address_shard( entry.address, m_numWorkerPacketProcessors ) : 0;
+
+        assert( entry.streamAllocator );
+        assert( entry.packetFactory );
+        assert( entry.packetFactory->GetNumPacketTypes() == m_packetFactory->GetNumPacketTypes() );
+    }
+
+    void BaseTransport::ReadEntryPacket( PacketProcessor & packetProcessor, ReadEntry & entry )
+    {
+        // IMPORTANT: this may run on a worker thread. it must only touch the entry, its packet factory and stream allocator, and the packet processor passed in.
 
-            m_packetProcessor->SetContext( context ? context->contextData : m_context );
+        packetProcessor.SetContext( entry.context );
 
-            Packet * packet = m_packetProcessor->ReadPacket( packetBuffer, sequence, packetBytes, encrypted, key, encryptedPacketTypes, unencryptedPacketTypes, *streamAllocator, *packetFactory );
+        entry.packet = packetProcessor.ReadPacket( entry.packetData, entry.sequence, entry.packetBytes, entry.encrypted, entry.key, entry.encryptedPacketTypes, entry.unencryptedPacketTypes, *entry.streamAllocator, *entry.packetFactory );
 
-            if ( !packet )
+        entry.error = packetProcessor.GetError();
+    }
+
+    void BaseTransport::FlushReadEntry( const ReadEntry & entry )
+    {
+        if ( !entry.packet )
+        {
+            switch ( entry.error )
             {
-                switch ( m_packetProcessor->GetError() )
+                case PACKET_PROCESSOR_ERROR_KEY_IS_NULL:
                 {
-                    case PACKET_PROCESSOR_ERROR_KEY_IS_NULL:
-                    {
-                        debug_printf( "base transport key is null (read packet)\n" );
-                        m_counters[TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES]++;
-                    }
-                    break;
+                    debug_printf( "base transport key is null (read packet)\n" );
+                    m_counters[TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES]++;
+                }
+                break;
 
-                    case PACKET_PROCESSOR_ERROR_DECRYPT_FAILED:
-                    {
-                        debug_printf( "base transport decrypt failed (read packet)\n" );
-                        m_counters[TRANSPORT_COUNTER_ENCRYPT_PACKET_FAILURES]++;
-                    }
-                    break;
+                case PACKET_PROCESSOR_ERROR_DECRYPT_FAILED:
+                {
+                    debug_printf( "base transport decrypt failed (read packet)\n" );
+                    m_counters[TRANSPORT_COUNTER_ENCRYPT_PACKET_FAILURES]++;
+                }
+                break;
 
-                    case PACKET_PROCESSOR_ERROR_PACKET_TOO_SMALL:
-                    {
-                        debug_printf( "base transport packet too small (read packet)\n" );
-                        m_counters[TRANSPORT_COUNTER_DECRYPT_PACKET_FAILURES]++;
-                    }
+                case PACKET_PROCESSOR_ERROR_PACKET_TOO_SMALL:
+                {
+                    debug_printf( "base transport packet too small (read packet)\n" );
+                    m_counters[TRANSPORT_COUNTER_DECRYPT_PACKET_FAILURES]++;
+                }
+                break;
+
+                case PACKET_PROCESSOR_ERROR_READ_PACKET_FAILED:
+                {
+                    debug_printf( "base transport read packet failed (read packet)\n" );
+                    m_counters[TRANSPORT_COUNTER_READ_PACKET_FAILURES]++;
+                }
+                break;
+
+                default:
                     break;
+            }
+
+            return;
+        }
+
+        PacketEntry packetEntry;
+        packetEntry.sequence = entry.sequence;
+        packetEntry.packet = entry.packet;
+        packetEntry.address = entry.address;
 
-                    case PACKET_PROCESSOR_ERROR_READ_PACKET_FAILED:
-                    {
-                        debug_printf( "base transport read packet failed (read packet)\n" );
-                        m_counters[TRANSPORT_COUNTER_READ_PACKET_FAILURES]++;
-                    }
+        m_receiveQueue.Push( packetEntry );
+
+        m_counters[TRANSPORT_COUNTER_PACKETS_READ]++;
+
+        if ( entry.encrypted )
+            m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_READ]++;
+        else
+            m_counters[TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_READ]++;
+    }
+
+    void BaseTransport::ReadPacketsParallel()
+    {
+        assert( m_workerPool );
+        assert( m_readEntries );
+        assert( m_readBatchBuffer );
+
+        // receives, raw packet handling, key and context lookups and the receive queue stay on this thread.
+        // decryption and deserialization are sharded by source address across workers, then pushed in arrival order.
+
+        const int maxPacketSize = GetMaxPacketSize();
+
+        bool done = false;
+
+        while ( !done )
+        {
+            m_numReadEntries = 0;
+
+            while ( m_numReadEntries < m_readBatchSize )
+            {
+                uint8_t * packetBuffer = m_readBatchBuffer + m_numReadEntries * m_readBatchStride;
+
+                Address address;
+                int packetBytes = InternalReceivePacket( address, packetBuffer, maxPacketSize );
+                if ( !packetBytes )
+                {
+                    done = true;
                     break;
+                }
+
+                assert( packetBytes > 0 );
 
-                    default:
-                        break;
+                if ( m_listener && m_listener->ProcessRawPacket( address, packetBuffer, packetBytes ) )
+                {
+                    m_counters[TRANSPORT_COUNTER_RAW_PACKETS_HANDLED]++;
+                    continue;
                 }
 
-                continue;
+                if ( m_receiveQueue.GetNumEntries() + m_numReadEntries >= m_receiveQueue.GetSize() )
+                {
+                    debug_printf( "base transport receive queue overflow\n" );
+                    m_counters[TRANSPORT_COUNTER_RECEIVE_QUEUE_OVERFLOW]++;
+                    done = true;
+                    break;
+                }
+
+                ReadEntry & entry = m_readEntries[m_numReadEntries++];
+                entry.address = address;
+                entry.packetData = packetBuffer;
+                entry.packetBytes = packetBytes;
+
+                PrepareReadEntry( entry );
             }
 
-            PacketEntry entry;
-            entry.sequence = sequence;
-            entry.packet = packet;
-            entry.address = address;
+            if ( m_numReadEntries == 0 )
+                break;
 
-            m_receiveQueue.Push( entry );
+            m_workerPool->Run( ReadPacketBatchWorker, this );
 
-            m_counters[TRANSPORT_COUNTER_PACKETS_READ]++;
+            for ( int i = 0; i < m_numReadEntries; ++i )
+                FlushReadEntry( m_readEntries[i] );
 
-            if ( encrypted )
-                m_counters[TRANSPORT_COUNTER_ENCRYPTED_PACKETS_READ]++;
-            else
-                m_counters[TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_READ]++;
+            m_numReadEntries = 0;
+        }
+    }
+
+    void BaseTransport::ReadPacketBatchWorker( void * data, int workerIndex )
+    {
+        BaseTransport * transport = (BaseTransport*) data;
+        transport->ReadPacketBatch( workerIndex );
+    }
+
+    void BaseTransport::ReadPacketBatch( int workerIndex )
+    {
+        assert( workerIndex >= 0 );
+        assert( workerIndex < m_numWorkerPacketProcessors );
+
+        PacketProcessor & packetProcessor = *m_workerPacketProcessors[workerIndex];
+
+        for ( int i = 0; i < m_numReadEntries; ++i )
+        {
+            ReadEntry & entry = m_readEntries[i];
+
+            if ( entry.worker == workerIndex )
+                ReadEntryPacket( packetProcessor, entry );
         }
     }
 
@@ -431,6 +734,81 @@ namespace yojimbo
         m_context = context;
     }
 
+    void BaseTransport::SetListener( TransportListener * listener )
+    {
+        m_listener = listener;
+    }
+
+    void BaseTransport::SetWorkerPool( WorkerPool * workerPool )
+    {
+        assert( m_sendQueue.IsEmpty() );
+
+        for ( int i = 0; i < m_numWorkerPacketProcessors; ++i )
+            YOJIMBO_DELETE( *m_allocator, PacketProcessor, m_workerPacketProcessors[i] );
+
+        if ( m_workerPacketProcessors )
+            m_allocator->Free( m_workerPacketProcessors );
+
+        if ( m_writeEntries )
+            m_allocator->Free( m_writeEntries );
+
+        if ( m_writeBatchBuffer )
+            m_allocator->Free( m_writeBatchBuffer );
+
+        if ( m_readEntries )
+            m_allocator->Free( m_readEntries );
+
+        if ( m_readBatchBuffer )
+            m_allocator->Free( m_readBatchBuffer );
+
+        m_workerPacketProcessors = NULL;
+        m_numWorkerPacketProcessors = 0;
+        m_writeEntries = NULL;
+        m_writeBatchBuffer = NULL;
+        m_writeBatchSize = 0;
+        m_writeBatchStride = 0;
+        m_readEntries = NULL;
+        m_readBatchBuffer = NULL;
+        m_readBatchSize = 0;
+        m_readBatchStride = 0;
+
+        m_workerPool = workerPool;
+
+        if ( !m_workerPool || m_workerPool->GetNumWorkers() <= 1 )
+            return;
+
+        const int numWorkers = m_workerPool->GetNumWorkers();
+
+        m_numWorkerPacketProcessors = numWorkers;
+        m_workerPacketProcessors = (PacketProcessor**) m_allocator->Allocate( sizeof( PacketProcessor* ) * numWorkers );
+        for ( int i = 0; i < numWorkers; ++i )
+            m_workerPacketProcessors[i] = YOJIMBO_NEW( *m_allocator, PacketProcessor, *m_allocator, m_protocolId, m_packetProcessor->GetMaxPacketSize() );
+
+        m_writeBatchSize = numWorkers * WritePacketsPerWorker;
+        if ( m_writeBatchSize > m_sendQueue.GetSize() )
+            m_writeBatchSize = m_sendQueue.GetSize();
+
+        m_writeBatchStride = m_workerPacketProcessors[0]->GetAbsoluteMaxPacketSize();
+
+        m_writeEntries = (WriteEntry*) m_allocator->Allocate( sizeof( WriteEntry ) * m_writeBatchSize );
+        for ( int i = 0; i < m_writeBatchSize; ++i )
+            new ( &m_writeEntries[i] ) WriteEntry();
+
+        m_writeBatchBuffer = (uint8_t*) m_allocator->Allocate( m_writeBatchSize * m_writeBatchStride );
+
+        m_readBatchSize = numWorkers * ReadPacketsPerWorker;
+        if ( m_readBatchSize > m_receiveQueue.GetSize() )
+            m_readBatchSize = m_receiveQueue.GetSize();
+
+        m_readBatchStride = m_packetProcessor->GetMaxPacketSize();
+
+        m_readEntries = (ReadEntry*) m_allocator->Allocate( sizeof( ReadEntry ) * m_readBatchSize );
+        for ( int i = 0; i < m_readBatchSize; ++i )
+            new ( &m_readEntries[i] ) ReadEntry();
+
+        m_readBatchBuffer = (uint8_t*) m_allocator->Allocate( m_readBatchSize * m_readBatchStride );
+    }
+
     void BaseTransport::SetStreamAllocator( Allocator & allocator )
     {
         m_streamAllocator = &allocator;
@@ -520,6 +898,11 @@ namespace yojimbo
         return m_address;
     }
 
+    uint32_t BaseTransport::GetProtocolId() const
+    {
+        return m_protocolId;
+    }
+
     PacketFactory * BaseTransport::GetPacketFactory()
     {
         return m_packetFactory;
@@ -34,6 +34,7 @@
 #include "yojimbo_allocator.h"
 #include "yojimbo_encryption.h"
 #include "yojimbo_packet_processor.h"
+#include "yojimbo_thread.h"
 
 namespace yojimbo
 {
@@ -59,9 +60,21 @@ namespace yojimbo
         TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_READ,
         TRANSPORT_COUNTER_UNENCRYPTED_PACKETS_WRITTEN,
         TRANSPORT_COUNTER_ENCRYPTION_MAPPING_FAILURES,
+        TRANSPORT_COUNTER_RAW_PACKETS_HANDLED,
         TRANSPORT_COUNTER_NUM_COUNTERS
     };
 
+    class TransportListener
+    {
+    public:
+
+        virtual ~TransportListener() {}
+
+        // Called with each datagram before it is decrypted or deserialized. Return true if the packet was fully handled and should be dropped by the transport.
+        
+        virtual bool ProcessRawPacket( const Address & /*from*/, const uint8_t * /*packetData*/, int /*packetBytes*/ ) { return false; }
+    };
+
     class Transport
     {
     public:
@@ -74,6 +87,8 @@ namespace yojimbo
 
         virtual void SendPacket( const Address & address, Packet * packet, uint64_t sequence = 0, bool immediate = false ) = 0;
 
+        virtual void SendPacketImmediate( const Address & address, Packet * packet, uint64_t sequence = 0 ) = 0;
+
         virtual Packet * ReceivePacket( Address & from, uint64_t * sequence = NULL ) = 0;
 
         virtual void WritePackets() = 0;
@@ -84,6 +99,10 @@ namespace yojimbo
 
         virtual void SetContext( void * context ) = 0;
 
+        virtual void SetListener( TransportListener * listener ) = 0;
+
+        virtual void SetWorkerPool( WorkerPool * workerPool ) = 0;
+
         virtual void SetStreamAllocator( Allocator & allocator ) = 0;
 
         virtual void EnablePacketEncryption() = 0;
@@ -116,6 +135,8 @@ namespace yojimbo
 
         virtual const Address & GetAddress() const = 0;
 
+        virtual uint32_t GetProtocolId() const = 0;
+
         virtual PacketFactory * GetPacketFactory() = 0;
     };
 
@@ -139,6 +160,8 @@ namespace yojimbo
 
         void SendPacket( const Address & address, Packet * packet, uint64_t sequence, bool immediate );
 
+        void SendPacketImmediate( const Address & address, Packet * packet, uint64_t sequence );
+
         Packet * ReceivePacket( Address & from, uint64_t * sequence );
 
         void WritePackets();
@@ -149,6 +172,10 @@ namespace yojimbo
 
         void SetContext( void * context );
 
+        void SetListener( TransportListener * listener );
+
+        void SetWorkerPool( WorkerPool * workerPool );
+
         void SetStreamAllocator( Allocator & allocator );
 
         void EnablePacketEncryption();
@@ -181,16 +208,74 @@ namespace yojimbo
 
         const Address & GetAddress() const;
 
+        uint32_t GetProtocolId() const;
+
         PacketFactory * GetPacketFactory();
 
     protected:
 
+        struct WriteEntry
+        {
+            Address address;                                                // address the packet is sent to.
+            Packet * packet;                                                // packet to write. destroyed on the calling thread once the batch is sent.
+            uint64_t sequence;                                              // packet sequence number.
+            bool encrypt;                                                   // true if the packet is encrypted.
+            const uint8_t * key;                                            // send key for the address. looked up before the batch is handed to workers.
+            void * context;                                                 // serialization context for the address.
+            Allocator * streamAllocator;                                    // stream allocator for the address.
+            PacketFactory * packetFactory;                                  // packet factory for the address.
+            int error;                                                      // packet processor error, if the packet could not be written.
+            int packetBytes;                                                // size of the written packet. zero if the write failed.
+        };
+
+        struct ReadEntry
+        {
+            Address address;                                                // address the packet was received from.
+            const uint8_t * packetData;                                     // raw packet data as received.
+            int packetBytes;                                                // size of the raw packet data.
+            const uint8_t * key;                                            // receive key for the address. looked up before the batch is handed to workers.
+            const uint8_t * encryptedPacketTypes;                           // packet types that must be encrypted.
+            const uint8_t * unencryptedPacketTypes;                         // packet types that may be sent unencrypted.
+            void * context;                                                 // serialization context for the address.
+            Allocator * streamAllocator;                                    // stream allocator for the address.
+            PacketFactory * packetFactory;                                  // packet factory for the address.
+            int worker;                                                     // worker that reads this packet. fixed per-address so each worker owns its clients.
+            Packet * packet;                                                // packet read. NULL if the read failed.
+            uint64_t sequence;                                              // packet sequence number.
+            bool encrypted;                                                 // true if the packet was encrypted.
+            int error;                                                      // packet processor error, if the packet could not be read.
+        };
+
         void ClearSendQueue();
 
         void ClearReceiveQueue();
 
         void WriteAndFlushPacket( const Address & address, Packet * packet, uint64_t sequence );
 
+        void PrepareWriteEntry( WriteEntry & entry );
+
+        const uint8_t * WriteEntryPacket( PacketProcessor & packetProcessor, WriteEntry & entry );
+
+        void FlushWriteEntry( const WriteEntry & entry, const uint8_t * packetData );
+
+        void WritePacketsParallel();
+
+        void WritePacketBatch( int workerIndex );
+
+        static void WritePacketBatchWorker( void * data, int workerIndex );
+
+        void PrepareReadEntry( ReadEntry & entry );
+
+        void ReadEntryPacket( PacketProcessor & packetProcessor, ReadEntry & entry );
+
+        void FlushReadEntry( const ReadEntry & entry );
+
+        void ReadPacketsParallel();
+
+        void ReadPacketBatch( int workerIndex );
+
+        static void ReadPacketBatchWorker( void * data, int workerIndex );
+
     protected:
 
         virtual bool InternalSendPacket( const Address & to, const void * packetData, int packetBytes ) = 0;
@@ -209,6 +294,8 @@ namespace yojimbo
 
         void * m_context;
 
+        TransportListener * m_listener;
+
         uint32_t m_protocolId;
 
         Allocator * m_allocator;
@@ -235,6 +322,32 @@ namespace yojimbo
         Queue<PacketEntry> m_sendQueue;
         Queue<PacketEntry> m_receiveQueue;
 
+        WorkerPool * m_workerPool;                                          // optional worker pool. when set, packets are serialized, encrypted, decrypted and read across workers.
+
+        PacketProcessor ** m_workerPacketProcessors;                        // one packet processor per-worker, so workers never share scratch buffers.
+
+        int m_numWorkerPacketProcessors;                                    // number of worker packet processors.
+
+        int m_writeBatchSize;                                               // maximum number of packets written per worker pool run.
+
+        int m_writeBatchStride;                                             // bytes per packet in the write batch buffer.
+
+        int m_numWriteEntries;                                              // number of packets in the current write batch.
+
+        WriteEntry * m_writeEntries;                                        // packets in the current write batch.
+
+        uint8_t * m_writeBatchBuffer;                                       // written packet data for the current batch. each packet gets its own slot.
+
+        int m_readBatchSize;                                                // maximum number of packets read per worker pool run.
+
+        int m_readBatchStride;                                              // bytes per packet in the read batch buffer.
+
+        int m_numReadEntries;                                               // number of packets in the current read batch.
+
+        ReadEntry * m_readEntries;                                          // packets in the current read batch.
+
+        uint8_t * m_readBatchBuffer;                                        // raw packet data for the current read batch. each packet gets its own slot.
+
 #if YOJIMBO_INSECURE_CONNECT
         uint8_t * m_allPacketTypes;
 #endif // #if YOJIMBO_INSECURE_CONNECT